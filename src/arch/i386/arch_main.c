@@ -3,11 +3,19 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <arch/align.h>
+#include <arch/atomic.h>
 #include <arch/cpu/cpu.h>
 #include <arch/cpu/gdt.h>
 #include <arch/cpu/idt.h>
+#include <arch/cpu/ioapic.h>
 #include <arch/cpu/lapic.h>
+#include <arch/cpu/percpu.h>
 #include <arch/cpu/smp.h>
+#include <arch/cpu/smp_call.h>
+#include <arch/cpu/syscall.h>
+#include <arch/cpu/topology.h>
+#include <arch/cpu/trampoline.h>
+#include <arch/cpu/tsc.h>
 #include <arch/kernel/mm/vm.h>
 #include <arch/paging.h>
 #include <arch/types.h>
@@ -15,10 +23,16 @@
 #include <kernel/assert.h>
 #include <kernel/bootinfo.h>
 #include <kernel/bootmem.h>
+#include <kernel/clocksource.h>
+#include <kernel/delay.h>
+#include <kernel/idle.h>
 #include <kernel/interrupt.h>
 #include <kernel/printk.h>
 #include <kernel/mm/pm.h>
+#include <kernel/sched.h>
+#include <kernel/spinlock.h>
 #include <lib/string.h>
+#include <platform/acpi.h>
 #include <platform/multiboot2.h>
 #include <platform/pic.h>
 #include <platform/pit.h>
@@ -38,7 +52,6 @@ extern void kernel_main(bootinfo_t*);
 
 bootinfo_t *boot_info;
 bool arch_init = true;
-bool ap_started = 0;
 
 static void parse_cmdline(multiboot2_information_header_t *m_boot2_info) {
 	boot_info->karg_entries = 0;
@@ -416,9 +429,38 @@ static int init_fpu() {
 	cr0 &= ~(1 << CR0_X87_FPU_SHIFT);
 	write_cr0(cr0);
 	asm volatile("fninit\n");	
+	
+	// Enable the SSE instructions and the full FXSAVE/FXRSTOR state, SIMD exceptions are reported as #XM.
+	
+	write_cr4(read_cr4() | CR4_OS_FXSAVE_FXRSTOR_SUPPORT | CR4_OS_UNMASKED_SIMD_EXCEPTIONS);
+	
+	// No thread owns the FPU yet: the first one using it traps and gets a clean state (see arch/cpu/fpu/fpu.c).
+	
+	write_cr0(read_cr0() | (1 << CR0_TASK_SHIFT));
 	return 0;
 }
 
+/*
+ * Returns the local apic timer mode asked on the kernel command line with timer=periodic, timer=oneshot or
+ * timer=deadline (one shot using the TSC deadline when supported). The default is deadline: with a one shot tick idle
+ * cpus stop ticking, timer=periodic keeps every cpu ticking.
+ */
+
+static uint32_t get_timer_mode() {
+	for (size_t i = 0; i < boot_info->karg_entries; i++) {
+		if (boot_info->karg_entry[i].key == NULL || boot_info->karg_entry[i].value == NULL || strcmp(boot_info->karg_entry[i].key, "timer") != 0) {
+			continue;
+		}
+		if (strcmp(boot_info->karg_entry[i].value, "oneshot") == 0) {
+			return LAPIC_TIMER_MODE_ONE_SHOT;
+		}
+		if (strcmp(boot_info->karg_entry[i].value, "periodic") == 0) {
+			return LAPIC_TIMER_MODE_PERIODIC;
+		}
+	}
+	return LAPIC_TIMER_MODE_TSC_DEADLINE;
+}
+
 /*
  * Code from here and beyond is just a mess that i was doing for testing smp booting.
  * Now that i got it working it's time to properly setup things.
@@ -426,57 +468,71 @@ static int init_fpu() {
 
 
 /*
- * This are just a page directory for the ap cpus and 2 page tables.
- * The first page table is for mapping the first 2Mb physical RAM at virtual addresses 0xC0100000 and the identity map.
- * Just like on the bsp cpu. The second page table is because i decided to allocate the ap cpus stacks starting at virtual
- * address 0xD0000000.
+ * Page directory used by the AP cpus while running the trampoline. It shares the kernel half of kernel_directory
+ * and additionally identity maps the first 2Mb physical RAM (where the trampoline and its parameters live).
  */
 
 __attribute__((__aligned__(PAGE_SIZE))) page_directory_t ap_boot_page_directory;
-__attribute__((__aligned__(PAGE_SIZE))) page_table_t ap_boot_page_table_0;
-__attribute__((__aligned__(PAGE_SIZE))) page_table_t ap_boot_page_table_1;
 
 /*
- * This is used to count milliseconds elapsed since the counter began counting.
+ * Number of application processors that completed their initialization.
  */
 
-static volatile uint32_t elapsed_milliseconds = 0;
-static volatile uint32_t elapsed_seconds = 0;
-
+static atomic_t ap_online = ATOMIC_INIT(0);
 
 /*
- * This is used for the delays required for the smp ap startup code.
+ * Serializes the per cpu initialization of the APs as the early boot allocator is not reentrant.
+ * It is a plain flag rather than a spinlock_t because the per cpu segment, where spinlocks keep their nesting counts,
+ * is only loaded by gdt_init() while it is held.
  */
 
-static void timer_callback() {
-	if ((++elapsed_milliseconds) % 1000 == 0) {
-		elapsed_seconds++;
-	}
-	pit_interrupt_rate_generator(1000);
-}
+static volatile uint32_t ap_init_lock = 0;
 
 /*
- * This is used for delaying for a specified amount of milliseconds.
+ * Mode of the local apic timer tick of every cpu, see get_timer_mode().
  */
 
-void delay(uint32_t ms) {
-	uint32_t end = elapsed_milliseconds + ms;
-	while (elapsed_milliseconds < end) {
-		arch_halt();
-	}
-}
+static uint32_t timer_mode = LAPIC_TIMER_MODE_TSC_DEADLINE;
+
 
 void smp_main(uint8_t lapic_id) {
-	ap_started = 1;
-	printk("AP[%x]: started!\n", lapic_id);
+
+	// Leave the trampoline page directory.
+
+	switch_address_space(&kernel_address_space);
+	
+	// The trampoline only starts enumerated processors, a stack mapped for an unknown identifier would be a bug.
+	
+	if (!get_cpu_data(lapic_id)) {
+		arch_cli();
+		while (true) {
+			arch_halt();
+		}
+	}
+	while (arch_atomic_swap(1, &ap_init_lock) != 0) {
+		arch_pause();
+	}
 	gdt_init(lapic_id);
 	idt_init(false);
+	arch_compiler_barrier();
+	ap_init_lock = 0;
+	if (sysenter && syscall_init()) {
+		panic("[KERNEL]: AP[%x] does not support SYSENTER! File: %s line: %d function: %s\n", lapic_id, __FILENAME__, __LINE__, __func__);
+	}
+	topology_init();
 	init_fpu();
-	printk("AP[%x]: initialized!\nAP[%x]: gdt address: %x\nper cpu structure address: %x\n", cpu->lapic_id, cpu->lapic_id, cpu->gdt, cpu);
-	if (lapic_id == 3) {
-		asm volatile("xorl %eax, %eax\nidiv %eax, %eax");
+	lapic_init();
+	if (lapic_timer_init(timer_mode)) {
+		panic("[KERNEL]: AP[%x] could not start its tick! File: %s line: %d function: %s\n", lapic_id, __FILENAME__, __LINE__, __func__);
 	}
-	arch_halt();
+	printk("AP[%x]: initialized!\nAP[%x]: gdt address: %x\nper cpu structure address: %x\n", cpu->lapic_id, cpu->lapic_id, cpu->gdt, cpu);
+	sched_init_cpu();
+	smp_set_cpu_online();
+	atomic_inc(&ap_online);
+	
+	// Idle with interrupts enabled so that the AP can serve cross cpu function calls and run kernel threads.
+	
+	cpu_idle();
 }
 
 /*
@@ -540,15 +596,36 @@ void arch_main(uint32_t magic, multiboot2_information_header_t *m_boot2_info) {
 	// Parse the multiboot2 memory map and format it according to the way the upper kernel layer expects it.
 	
 	parse_memory_map(m_boot2_info);	
-	smp_init();
-
-	// Assuming 0 for the local apic identifier of the bootstrap processor.
 	
-	gdt_init(0);
+	// Look for the ACPI MADT first, smp_init() falls back to the MP tables if it is not found.
+	
+	acpi_init(m_boot2_info);
+	smp_init();
+	percpu_init_bsp();
+	gdt_init(get_lapic_id());
+	topology_init();
+	smp_set_cpu_online();
 	idt_init(true);
+	sysenter = syscall_init() == 0;
+	if (!sysenter) {
+		printk("[KERNEL]: SYSENTER/SYSEXIT not supported, system calls are not available.\n");
+	}
 	pic_init();
+	
+	// PIT channel 2 keeps time until the TSC is calibrated against it, it stays the clocksource if there is no TSC.
+	
+	if (pit_clocksource_init()) {
+		panic("[KERNEL]: Failed to initialize the PIT clocksource! File: %s line: %d function: %s\n", __FILENAME__, __LINE__, __func__);
+	}
+	if (tsc_init()) {
+		printk("[KERNEL]: No usable TSC, keeping the PIT clocksource.\n");
+	}
 	pmm_init(boot_info);
 	
+	// Preallocate the kernel half of the kernel directory so that it can be shared by every address space.
+	
+	vm_init();
+	
 	/* 
 	 * This messy shit was just for testing smp booting...now that it works it's time to organize things properly.
 	 * First i need to implement a virtual memory address space allocator for in kernel use because i cannot
@@ -558,7 +635,7 @@ void arch_main(uint32_t magic, multiboot2_information_header_t *m_boot2_info) {
 	// TODO: add per cpu data cr3.
 	
 	if (smp) {
-		printk("[KERNEL]: System is MP compliant!\nFound %d cpus!\n", num_cpus);
+		printk("[KERNEL]: System is %s compliant!\nFound %d cpus!\n", acpi ? "ACPI" : "MP", num_cpus);
 		for (size_t i = 0; i < num_cpus; i++) {
 			printk("CPU [%s] with ID: %x\n", cpu_data[i].bsp ? "BSP" : "AP", cpu_data[i].lapic_id);
 		}
@@ -568,89 +645,94 @@ void arch_main(uint32_t magic, multiboot2_information_header_t *m_boot2_info) {
         map_page(io_apic_address, io_apic_address, PROT_PRESENT | PROT_READ_WRITE | PROT_KERN | PROT_CACHE_DISABLE, false);
 		printk("[KERNEL]: local apic physical address (identity mapped) on each cpu is: %x\n[KERNEL]: io apic physical address (identity mapped) is: %x\n[KERNEL]: Starting application processors...\n", io_apic_address, local_apic_address);
 		lapic_init();
-		if (register_interrupt_handler(32, timer_callback)) {
-			panic("[KERNEL]: Could not register interrupt handler! File: %s line: %d function: %s\n", __FILENAME__, __LINE__, __func__);
-		}
-		pic_enable_irq_line(0);
+		smp_call_init();
+		
+		// Device interrupts go through the io apics when there are any.
+		
+		ioapic_init();
 		arch_sti();
-		void *dest = (void*) PHYSICAL_TO_VIRTUAL(0x1000);
+		
+		// Every cpu gets its own tick from its local apic timer, calibrated once here.
+		
+		if (lapic_timer_calibrate()) {
+			panic("[KERNEL]: Failed to calibrate the local apic timer! File: %s line: %d function: %s\n", __FILENAME__, __LINE__, __func__);
+		}
+		timer_mode = get_timer_mode();
+		if (lapic_timer_init(timer_mode)) {
+			panic("[KERNEL]: Could not start the tick! File: %s line: %d function: %s\n", __FILENAME__, __LINE__, __func__);
+		}
+		percpu_init_aps();
+		void *dest = (void*) PHYSICAL_TO_VIRTUAL(AP_TRAMPOLINE_ADDRESS);
 		memcpy(dest, &_binary_boot_ap_start, (size_t) &_binary_boot_ap_size);
 		
-		// Map first 2Mb physical RAM.
+		/*
+		 * The kernel half is shared with kernel_directory, the first 2Mb physical RAM are identity mapped by reusing
+		 * the kernel boot page table (which maps them at 0xC0000000).
+		 */
 		
-		for (size_t i = 0; i < 512; i++) {
-			ap_boot_page_table_0.entry[i].present = 1;
-			ap_boot_page_table_0.entry[i].address = (i*4096) >> 12;
-			ap_boot_page_table_0.entry[i].read_write = 1;
-			ap_boot_page_table_0.entry[i].user_supervisor = 0;
+		for (size_t i = KERNEL_DIRECTORY_FIRST_ENTRY; i < RECURSIVE_DIRECTORY_ENTRY; i++) {
+			ap_boot_page_directory.entry[i] = kernel_directory.entry[i];
 		}
+		ap_boot_page_directory.entry[0] = kernel_directory.entry[KERNEL_DIRECTORY_FIRST_ENTRY];
+		ap_boot_parameters_t *parameters = (ap_boot_parameters_t*) PHYSICAL_TO_VIRTUAL(AP_BOOT_PARAMETERS_ADDRESS);
+		parameters->page_directory = VIRTUAL_TO_PHYSICAL(&ap_boot_page_directory);
+		parameters->entry = smp_main;
+		memset(parameters->stacks, 0x0, sizeof(parameters->stacks));
 		
-		// Identity map 2Mb physical to 2Mb virtual.
+		/*
+		 * Map one stack per enumerated AP from AP_STACKS_START in the kernel directory (and so in the ap boot page directory),
+		 * indexed by its local apic identifier. The first page of every stack slot is the guard page and stays unmapped.
+		 */
 		
-		ap_boot_page_directory.entry[0].present = 1;
-		ap_boot_page_directory.entry[0].address = (uint32_t) VIRTUAL_TO_PHYSICAL(&ap_boot_page_table_0) >> 12;
-		ap_boot_page_directory.entry[0].read_write = 1;
-		ap_boot_page_directory.entry[0].user_supervisor = 0;
+		size_t ap_count = 0;
+		for (size_t i = 0; i < num_cpus; i++) {
+			if (cpu_data[i].bsp) {
+				continue;
+			}
+			virt_addr_t ap_stack_virtual = AP_STACKS_START + (ap_count * AP_STACK_SLOT_SIZE) + PAGE_SIZE;
+			for (size_t page = 0; page < AP_STACK_PAGES; page++) {
+				phys_addr_t ap_stack = get_free_frame();
+				if (ap_stack == (phys_addr_t) -1) {
+					panic("[KERNEL]: Failed to allocated memory! File: %s line: %d function: %s\n", __FILENAME__, __LINE__, __func__);
+				}
+				if (map_page(ap_stack, ap_stack_virtual + (page * PAGE_SIZE), PROT_PRESENT | PROT_READ_WRITE | PROT_KERN, false)) {
+					panic("[KERNEL]: Failed to map AP stack! File: %s line: %d function: %s\n", __FILENAME__, __LINE__, __func__);
+				}
+			}
+			parameters->stacks[cpu_data[i].lapic_id] = ap_stack_virtual + (AP_STACK_PAGES * PAGE_SIZE);
+			ap_count++;
+		}
 		
-		// Map 2Mb physical to 0xC0100000 virtual.
+		/*
+		 * Wake up all the APs at once with the INIT-SIPI-SIPI sequence sent to all excluding self.
+		 * The second SIPI is ignored by the APs which already started.
+		 */
 		
-		ap_boot_page_directory.entry[768].present = 1;
-		ap_boot_page_directory.entry[768].address = (uint32_t) VIRTUAL_TO_PHYSICAL(&ap_boot_page_table_0) >> 12;
-		ap_boot_page_directory.entry[768].read_write = 1;
-		ap_boot_page_directory.entry[768].user_supervisor = 0;
+		uint32_t sipi = (AP_TRAMPOLINE_ADDRESS >> 12) | LAPIC_ICR_DELIVERY_MODE_STARTUP | LAPIC_ICR_DESTINATION_MODE_PHYSICAL | LAPIC_ICR_TRIGGER_MODE_EDGE | LAPIC_ICR_DESTINATION_ALL_EXCLUDING_SELF;
+		lapic_send_ipi(0, LAPIC_ICR_DELIVERY_MODE_INIT | LAPIC_ICR_DESTINATION_MODE_PHYSICAL | LAPIC_ICR_LEVEL_ASSERT | LAPIC_ICR_TRIGGER_MODE_EDGE | LAPIC_ICR_DESTINATION_ALL_EXCLUDING_SELF);
+		lapic_wait_ipi_delivery();
+		mdelay(10);
+		lapic_send_ipi(0, sipi);
+		lapic_wait_ipi_delivery();
 		
-		// Map whatever physical frame we get for ap cpus stack to virtual addresses starting at 0xD0000000.
+		// The spec asks for 200 micro seconds between the two SIPIs.
 		
-		ap_boot_page_directory.entry[832].present = 1;
-		ap_boot_page_directory.entry[832].address = (uint32_t) VIRTUAL_TO_PHYSICAL(&ap_boot_page_table_1) >> 12;
-		ap_boot_page_directory.entry[832].read_write = 1;
-		ap_boot_page_directory.entry[832].user_supervisor = 0;
-		virt_addr_t ap_stack_virtual = 0xD0001000;
-		for (size_t i = 1; i < num_cpus; i++) {
-			void *ap_code = (void*) PHYSICAL_TO_VIRTUAL(0x1000);
-			phys_addr_t ap_stack = get_free_frame();
-			if (ap_stack == (phys_addr_t) -1) {
-				panic("[KERNEL]: Failed to allocated memory! File: %s line: %d function: %s\n", __FILENAME__, __LINE__, __func__);
-			}
-			
-			// Map ap cpus stack vo virtual address starting at 0xD0000000 in the kernel directory.
-			
-			map_page(ap_stack, ap_stack_virtual, PROT_PRESENT | PROT_READ_WRITE | PROT_KERN, false);
-			
-			// Map ap cpus stack to virtual address starting at 0xD0000000 in the ap boot page directory.
-			
-			ap_boot_page_table_1.entry[i].present = 1;
-			ap_boot_page_table_1.entry[i].address = ap_stack >> 12;
-			ap_boot_page_table_1.entry[i].read_write = 1;
-			ap_boot_page_table_1.entry[i].user_supervisor = 0;
-			*(void**) (ap_code - 4) = (void*) VIRTUAL_TO_PHYSICAL(&ap_boot_page_directory);
-			*(void**) (ap_code - 8) = (void*) ((size_t) ap_stack_virtual + 4096);
-			*(void**) (ap_code - 12) = (void*) smp_main;
-			*(void**) (ap_code - 16) = (void*) (uint32_t) cpu_data[i].lapic_id;
-			lapic_send_ipi(cpu_data[i].lapic_id, LAPIC_ICR_DELIVERY_MODE_INIT | LAPIC_ICR_DESTINATION_MODE_PHYSICAL | LAPIC_ICR_LEVEL_ASSERT | LAPIC_ICR_TRIGGER_MODE_LEVEL | LAPIC_ICR_DESTINATION_NO_SHORTHAND);
-			do {
-				asm("pause");
-			} while (LAPIC_ICR_DELIVERY_STATUS(lapic_read(LAPIC_INTERRUPT_COMMAND_REGISTER_0)) != LAPIC_ICR_DELIVERY_STATUS_IDLE);
-			lapic_send_ipi(cpu_data[i].lapic_id, LAPIC_ICR_DELIVERY_MODE_INIT | LAPIC_ICR_DESTINATION_MODE_PHYSICAL | LAPIC_ICR_LEVEL_DE_ASSERT | LAPIC_ICR_TRIGGER_MODE_LEVEL | LAPIC_ICR_DESTINATION_NO_SHORTHAND);
-			do {
-				asm("pause");
-			} while (LAPIC_ICR_DELIVERY_STATUS(lapic_read(LAPIC_INTERRUPT_COMMAND_REGISTER_0)) != LAPIC_ICR_DELIVERY_STATUS_IDLE);
-			delay(10);
-			
-			// For now just send 1 SIPI and later add logic to send again and delay more increasingly.
-			
-			lapic_send_ipi(cpu_data[i].lapic_id, ((uint32_t) VIRTUAL_TO_PHYSICAL(ap_code) >> 12) | LAPIC_ICR_DELIVERY_MODE_STARTUP | LAPIC_ICR_DESTINATION_MODE_PHYSICAL | LAPIC_ICR_TRIGGER_MODE_LEVEL| LAPIC_ICR_DESTINATION_NO_SHORTHAND);
-			
-			// Delaying more than the 200 micro seconds specified in the spec.
-			
-			delay(1);
-			do {
-				asm("pause");
-			}
-			while (LAPIC_ICR_DELIVERY_STATUS(lapic_read(LAPIC_INTERRUPT_COMMAND_REGISTER_0)) != LAPIC_ICR_DELIVERY_STATUS_IDLE);
-			ap_stack_virtual += 4096;
+		udelay(200);
+		lapic_send_ipi(0, sipi);
+		lapic_wait_ipi_delivery();
+		
+		// Wait once for every AP to come online.
+		
+		uint64_t timeout = ktime_get_ns() + (AP_BOOT_TIMEOUT * NSEC_PER_MSEC);
+		while ((uint32_t) atomic_read(&ap_online) < ap_count && ktime_get_ns() < timeout) {
+			arch_pause();
 		}
+		printk("[KERNEL]: %d of %d application processors online.\n", atomic_read(&ap_online), ap_count);
 	}
+	
+	// Every cpu filled its own topology record, link them together.
+	
+	topology_build_masks();
 	printk("BSP[%x]: gdt address: %x\nper cpu structure address: %x\ncurrent directory: %x\n", cpu->lapic_id, cpu->gdt, cpu);
 	arch_init = false;
 	kernel_main(boot_info);
@@ -2,11 +2,13 @@
 #include <stdint.h>
 #include <arch/cpu/cpu.h>
 #include <arch/cpu/exception_interrupt.h>
+#include <arch/cpu/fpu.h>
 #include <arch/cpu/gdt.h>
 #include <arch/cpu/io.h>
 #include <arch/cpu/smp.h>
 #include <arch/kernel/mm/vm.h>
 #include <lib/string.h>
+#include <kernel/irqstat.h>
 #include <kernel/printk.h>
 
 /*
@@ -18,6 +20,19 @@ extern uint32_t walk_stack(uint32_t *array, uint32_t number_frames);
 
 void exception_common_handler(exception_context_t *context) {
         static uint32_t nested_counter = 0;
+        uint32_t eflags = arch_irq_save();
+        irqstat_count(context->number);
+        arch_irq_restore(eflags);
+
+        /*
+        * With lazy FPU switching #NM is a regular trap every thread takes when it first uses the FPU, on several cpus at
+        * once and possibly preempted inside the handler: it must not count as a nested exception.
+        */
+
+        if (context->number == 7) {
+                fpu_device_not_available();
+                return;
+        }
 
         /*
         * The following code could happen if the call chain beginning here ends up 
@@ -0,0 +1,125 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <arch/cpu/cpu.h>
+#include <arch/cpu/fpu.h>
+#include <arch/cpu/percpu.h>
+#include <kernel/assert.h>
+#include <kernel/preempt.h>
+#include <kernel/printk.h>
+#include <kernel/sched.h>
+#include <kernel/thread.h>
+#include <lib/string.h>
+
+/*
+ * Lazy FPU switching. CR0.TS is set whenever the running thread does not have its state in the FPU registers, so that its
+ * first FPU/SSE instruction raises #NM (see fpu_device_not_available()) and the state is only loaded by threads that use it.
+ * fpu_owner is the state the registers of this cpu were last loaded with, fpu_active is true while TS is clear and the
+ * registers belong to the running thread (they may hold changes not saved yet).
+ * A thread is saved when it is switched out after using the FPU, the registers keep a copy of its state: if it runs again on
+ * the same cpu and nobody used the FPU in between, TS is cleared right away and it does not even trap.
+ */
+
+DEFINE_PER_CPU(fpu_t*, fpu_owner);
+DEFINE_PER_CPU(bool, fpu_active);
+DEFINE_PER_CPU(bool, kernel_fpu_in_use);
+
+static inline void fpu_reset(void) {
+        uint32_t mxcsr = FPU_MXCSR_DEFAULT;
+        asm volatile("fninit; ldmxcsr %0" : : "m" (mxcsr));
+}
+
+void fpu_state_init(fpu_t *fpu) {
+        memset(fpu, 0x0, sizeof(fpu_t));
+        fpu->last_cpu = FPU_NO_CPU;
+}
+
+/*
+ * Called by schedule() with interrupts disabled before switching from prev to next.
+ */
+
+void fpu_switch(fpu_t *prev, fpu_t *next) {
+        size_t self = this_cpu_read(cpu_index);
+        bool active = this_cpu_read(fpu_active);
+        if (active) {
+                fpu_fxsave(prev);
+                prev->last_cpu = self;
+        }
+        if (this_cpu_read(fpu_owner) == next && next->last_cpu == self) {
+                if (!active) {
+                        fpu_clts();
+                }
+                this_cpu_write(fpu_active, true);
+                return;
+        }
+        if (active) {
+                fpu_stts();
+                this_cpu_write(fpu_active, false);
+        }
+}
+
+/*
+ * Device not available (#NM) handler: the running thread used the FPU while TS was set. Its state is loaded, or a clean
+ * one the first time, and the faulting instruction is restarted with TS clear.
+ */
+
+void fpu_device_not_available() {
+        thread_t *current = thread_current();
+        if (current == NULL || in_interrupt() || this_cpu_read(kernel_fpu_in_use)) {
+                panic("[KERNEL]: FPU used without kernel_fpu_begin()! File: %s line: %d function: %s\n", __FILENAME__, __LINE__, __func__);
+        }
+        uint32_t eflags = arch_irq_save();
+        fpu_t *fpu = &current->fpu;
+        fpu_clts();
+        if (fpu->initialized) {
+                fpu_fxrstor(fpu);
+        }
+        else {
+                fpu_reset();
+                fpu->initialized = true;
+        }
+        fpu->last_cpu = this_cpu_read(cpu_index);
+        this_cpu_write(fpu_owner, fpu);
+        this_cpu_write(fpu_active, true);
+        arch_irq_restore(eflags);
+}
+
+/*
+ * Returns true if kernel_fpu_begin() can be called, false if this cpu is already inside a kernel FPU section (an interrupt
+ * handler that interrupted one must fall back to code that does not use the FPU).
+ */
+
+bool kernel_fpu_usable() {
+        return !this_cpu_read(kernel_fpu_in_use);
+}
+
+/*
+ * Lets kernel code use the FPU/SSE registers until kernel_fpu_end(). The state of the running thread is saved first if it is
+ * in the registers. Preemption is disabled in between and sections must not be nested.
+ * Can be called from interrupt handlers if kernel_fpu_usable() returns true.
+ */
+
+void kernel_fpu_begin() {
+        preempt_disable();
+        uint32_t eflags = arch_irq_save();
+        if (this_cpu_read(kernel_fpu_in_use)) {
+                panic("[KERNEL]: Nested kernel_fpu_begin()! File: %s line: %d function: %s\n", __FILENAME__, __LINE__, __func__);
+        }
+        if (this_cpu_read(fpu_active)) {
+                fpu_fxsave(this_cpu_read(fpu_owner));
+                this_cpu_write(fpu_active, false);
+        }
+        else {
+                fpu_clts();
+        }
+        this_cpu_write(fpu_owner, NULL);
+        this_cpu_write(kernel_fpu_in_use, true);
+        arch_irq_restore(eflags);
+        fpu_reset();
+}
+
+void kernel_fpu_end() {
+        fpu_stts();
+        this_cpu_write(kernel_fpu_in_use, false);
+        preempt_enable();
+}
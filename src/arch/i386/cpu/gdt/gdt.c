@@ -1,12 +1,35 @@
 #include <arch/cpu/cpu.h>
 #include <arch/cpu/gdt.h>
+#include <arch/cpu/percpu.h>
 #include <arch/cpu/smp.h>
+#include <arch/cpu/tss.h>
 #include <kernel/assert.h>
 #include <kernel/bootmem.h>
 #include <lib/string.h>
 
 extern void load_gdt(gdt_descriptor_t*);
 
+DEFINE_PER_CPU(tss_t, tss);
+
+/*
+ * A task state segment descriptor is a system segment with byte granularity, which the SEGMENT() macro does not describe.
+ */
+
+static void set_tss_entry(gdt_entry_t *entry, uint32_t base, uint32_t limit) {
+	*entry = SEGMENT_NULL;
+	entry->limit_0_15 = limit & 0xFFFF;
+	entry->base_0_15 = base & 0xFFFF;
+	entry->base_16_23 = (base >> 16) & 0xFF;
+
+	// Type 0x9: 32 bit available TSS.
+
+	entry->accessed = 1;
+	entry->type = 1;
+	entry->present = 1;
+	entry->limit_16_19 = (limit >> 16) & 0xF;
+	entry->base_24_31 = base >> 24;
+}
+
 /*
  * This function is used to set new gdt entries after initialization. 
  * This function shuould not be used to alter existing entries that are in use or potential crashes could happen.
@@ -34,6 +57,10 @@ void set_gdt_entry(gdt_entry_t *gdt, uint16_t number, uint32_t base, uint32_t li
 }
 
 void gdt_init(uint8_t lapic_id) {
+	cpu_data_t *this_cpu = get_cpu_data(lapic_id);
+	if (!this_cpu) {
+		panic("[KERNEL]: Unknown local apic id %x! File: %s line: %d function: %s\n", lapic_id, __FILENAME__, __LINE__, __func__);
+	}
 	gdt_entry_t *gdt = (gdt_entry_t*) b_malloc(sizeof(gdt_entry_t) * GDT_MAX_ENTRIES);
 	if (!gdt) {
 		panic("[KERNEL]: Failed to allocate memory! File: %s line: %d function: %s\n", __FILENAME__, __LINE__, __func__);
@@ -49,15 +76,24 @@ void gdt_init(uint8_t lapic_id) {
 	gdt[1] = SEGMENT_KCODE(0, 0xFFFFFFFF);
 	gdt[2] = SEGMENT_KDATA(0, 0xFFFFFFFF);
 
-	// The next 2 segments refer to the usermode code and data segments which will be added later and are set to NULL for now.
+	gdt[3] = SEGMENT_UCODE(0, 0xFFFFFFFF);
+	gdt[4] = SEGMENT_UDATA(0, 0xFFFFFFFF);
+
+	// Per cpu segment, see arch/cpu/percpu.h.
+
+	gdt[5] = SEGMENT_KDATA(per_cpu_offset[this_cpu - cpu_data], 0xFFFFFFFF);
+
+	// The task state segment of this cpu, written through its address as %gs is not loaded yet.
 
-	gdt[3] = SEGMENT_NULL;
-	gdt[4] = SEGMENT_NULL;
-	gdt[5] = SEGMENT_KDATA(&cpu_data[lapic_id].cpu, 8);
+	tss_t *this_tss = per_cpu_ptr(tss, this_cpu - cpu_data);
+	memset(this_tss, 0x0, sizeof(tss_t));
+	this_tss->ss0 = GDT_KERNEL_DATA_OFFSET;
+	this_tss->iomap_base = sizeof(tss_t);
+	set_tss_entry(&gdt[6], (uint32_t) this_tss, sizeof(tss_t) - 1);
 	gdt_descriptor->table_size = (sizeof(gdt_entry_t) * GDT_MAX_ENTRIES) - 1;
 	gdt_descriptor->table_address = &gdt[0];
-	cpu_data[lapic_id].gdt = (virt_addr_t*) gdt_descriptor->table_address;
+	this_cpu->gdt = (virt_addr_t*) gdt_descriptor->table_address;
 	load_gdt(gdt_descriptor);
 	load_gs(GDT_KERNEL_PER_CPU_DATA_OFFSET);
-	cpu = &cpu_data[lapic_id];
+	load_tr(GDT_TSS_OFFSET);
 }
\ No newline at end of file
@@ -1,19 +1,52 @@
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <arch/atomic.h>
 #include <arch/cpu/cpu.h>
 #include <arch/cpu/exception_interrupt.h>
 #include <arch/cpu/gdt.h>
 #include <arch/cpu/io.h>
+#include <arch/cpu/lapic.h>
+#include <arch/cpu/percpu.h>
 #include <arch/cpu/smp.h>
 #include <kernel/interrupt.h>
+#include <kernel/irqstat.h>
+#include <kernel/preempt.h>
 #include <kernel/printk.h>
+#include <kernel/rcu.h>
+#include <kernel/sched.h>
+#include <kernel/softirq.h>
+#include <kernel/spinlock.h>
 #include <platform/pic.h>
 
 extern bool arch_init;
 
-static interrupt_handler_t interrupt_handler_table[256];
+typedef struct interrupt_vector {
+    interrupt_action_t *actions;
+    bool allocated;
+    uint32_t unhandled;
+} interrupt_vector_t;
 
-int register_interrupt_handler(uint8_t interrupt_number, interrupt_handler_t handler) {
+static interrupt_vector_t interrupt_vectors[256];
+
+/*
+ * The action lists are read under RCU by the dispatcher, writers (and the vector allocator) are serialized by
+ * interrupt_handler_lock. Once unregister_interrupt_handler() returns the action is not used anywhere.
+ */
+
+static spinlock_t interrupt_handler_lock = {
+    name: "irqtab",
+    lock: 0,
+};
+
+DEFINE_PER_CPU(uint32_t, irq_count);
+
+/*
+ * Adds action to the actions of interrupt_number, behind the ones already there. Returns -1 if the vector cannot be
+ * registered, was not allocated (in the dynamic range), or already has actions and they or action are not shared.
+ */
+
+int register_interrupt_handler(uint8_t interrupt_number, interrupt_action_t *action) {
 
     /* 
      * Return failure in case something tries to register these interrupt numbers:
@@ -23,30 +56,131 @@ int register_interrupt_handler(uint8_t interrupt_number, interrupt_handler_t han
      * and the APIC spurious interrupt vector (255).
      */
 
-    if (interrupt_number <= 31 || (!smp && (interrupt_number == 39 || interrupt_number == 47)) || (smp && !arch_init && (interrupt_number >= 32 || interrupt_number <= 47 || interrupt_number == 255))) {
+    if (interrupt_number <= 31 || (!smp && (interrupt_number == 39 || interrupt_number == 47)) || (smp && !arch_init && ((interrupt_number >= 32 && interrupt_number <= 47) || interrupt_number == 255))) {
         return -1;
     }
-    interrupt_handler_table[interrupt_number] = handler;
+    if (action == NULL || action->handler == NULL) {
+        return -1;
+    }
+    interrupt_vector_t *vector = &interrupt_vectors[interrupt_number];
+    lock(&interrupt_handler_lock);
+    if (interrupt_number >= INTERRUPT_DYNAMIC_VECTOR_START && interrupt_number <= INTERRUPT_DYNAMIC_VECTOR_END && !vector->allocated) {
+        unlock(&interrupt_handler_lock);
+        return -1;
+    }
+    interrupt_action_t **tail = &vector->actions;
+    while (*tail) {
+        if (*tail == action || !((*tail)->flags & INTERRUPT_SHARED) || !(action->flags & INTERRUPT_SHARED)) {
+            unlock(&interrupt_handler_lock);
+            return -1;
+        }
+        tail = &(*tail)->next;
+    }
+    action->next = NULL;
+    rcu_assign_pointer(*tail, action);
+    unlock(&interrupt_handler_lock);
     return 0;
 }
 
-void unregister_interrupt_handler(uint8_t interrupt_number) {
-    if (interrupt_handler_table[interrupt_number] == NULL) {
+/*
+ * Must not be called from interrupt handlers as it waits for a grace period. Returns -1 if action is not registered on
+ * interrupt_number.
+ */
+
+int unregister_interrupt_handler(uint8_t interrupt_number, interrupt_action_t *action) {
+    lock(&interrupt_handler_lock);
+    interrupt_action_t **link = &interrupt_vectors[interrupt_number].actions;
+    while (*link && *link != action) {
+        link = &(*link)->next;
+    }
+    if (*link == NULL) {
+        unlock(&interrupt_handler_lock);
         printk("[KERNEL]: Tried to unregister a handler for a non registered interrupt number!\n");
-        return;
+        return -1;
+    }
+
+    // Readers already on action keep following its next pointer, which is left as is until the grace period ends.
+
+    rcu_assign_pointer(*link, action->next);
+    unlock(&interrupt_handler_lock);
+    synchronize_rcu();
+    return 0;
+}
+
+/*
+ * Returns a free vector of the dynamic range for the caller to register handlers on, -1 if there is none left.
+ */
+
+int interrupt_vector_alloc() {
+    lock(&interrupt_handler_lock);
+    for (int i = INTERRUPT_DYNAMIC_VECTOR_START; i <= INTERRUPT_DYNAMIC_VECTOR_END; i++) {
+        if (!interrupt_vectors[i].allocated) {
+            interrupt_vectors[i].allocated = true;
+            interrupt_vectors[i].unhandled = 0;
+            unlock(&interrupt_handler_lock);
+            return i;
+        }
     }
-    else {
-        interrupt_handler_table[interrupt_number] = NULL;
+    unlock(&interrupt_handler_lock);
+    return -1;
+}
+
+/*
+ * Returns -1 if interrupt_number was not allocated or still has handlers.
+ */
+
+int interrupt_vector_free(uint8_t interrupt_number) {
+    if (interrupt_number < INTERRUPT_DYNAMIC_VECTOR_START || interrupt_number > INTERRUPT_DYNAMIC_VECTOR_END) {
+        return -1;
+    }
+    lock(&interrupt_handler_lock);
+    interrupt_vector_t *vector = &interrupt_vectors[interrupt_number];
+    if (!vector->allocated || vector->actions != NULL) {
+        unlock(&interrupt_handler_lock);
+        return -1;
+    }
+    vector->allocated = false;
+    unlock(&interrupt_handler_lock);
+    return 0;
+}
+
+/*
+ * Runs the actions of the interrupt, all of them since devices sharing a vector can raise it at the same time. An
+ * interrupt none of the actions of its vector handled is reported the first time only, vectors without actions are
+ * ignored.
+ */
+
+static void handle_interrupt(interrupt_context_t *context) {
+    interrupt_vector_t *vector = &interrupt_vectors[context->number];
+    int handled = INTERRUPT_NONE;
+    rcu_read_lock();
+    interrupt_action_t *action = rcu_dereference(vector->actions);
+    bool has_actions = action != NULL;
+    while (action) {
+        handled |= action->handler(context, action->dev_id);
+        action = rcu_dereference(action->next);
+    }
+    rcu_read_unlock();
+    if (has_actions && handled == INTERRUPT_NONE && arch_atomic_fetch_add(1, &vector->unhandled) == 0) {
+        printk("[KERNEL]: Unhandled interrupt %d!\n", context->number);
     }
 }
 
 void interrupt_common_handler(interrupt_context_t *context) {
+    #ifdef IRQSTAT
+        uint64_t entry_tsc = read_tsc();
+    #endif
+    this_cpu_inc(irq_count);
+    irqstat_count(context->number);
+    rcu_irq_enter();
     if (context->number == 14) {
         panic("Page fault at address: %x\n", read_cr2());
     }
     if (context->number == 39) {
         if (pic_read_register(READ_MASTER | READ_ISR) & ISR_IRQ7_NOT_IN_SERVICE) {
             printk("Spurious interrupt on PIC1 detected!\n");
+            rcu_irq_exit();
+            this_cpu_dec(irq_count);
             return;
         }
         else {
@@ -63,14 +197,33 @@ void interrupt_common_handler(interrupt_context_t *context) {
             pic_send_eoi(PIC2_COMMAND_PORT);
         }
     }
-    interrupt_handler_t handler = interrupt_handler_table[context->number];
-    if (handler != NULL) {
-        handler();
-    }
-    if (context->number >= 40) {
+    handle_interrupt(context);
+
+    // Only the PIC range (32 - 47) is acknowledged to the 8259s, the port I/O must stay off the local apic vectors.
+
+    if (context->number >= 40 && context->number < 48) {
         pic_send_eoi(PIC2_COMMAND_PORT);
     }
-    else if (context->number >= 31 && context->number < 40) {
+    else if (context->number >= 32 && context->number < 40) {
         pic_send_eoi(PIC1_COMMAND_PORT);
     }
+
+    // Vectors past the PIC range are delivered by the local apic, which must not be acknowledged for its spurious vector.
+
+    if (smp && context->number >= 48 && context->number != 255) {
+        lapic_send_eoi();
+    }
+    #ifdef IRQSTAT
+        irqstat_latency(context->number, read_tsc() - entry_tsc);
+    #endif
+
+    // Softirqs run with interrupts enabled, nested interrupts still see this one in irq_count and leave them alone.
+
+    softirq_irq_exit();
+    rcu_irq_exit();
+    this_cpu_dec(irq_count);
+
+    // The interrupt is acknowledged, the interrupted thread can be switched away from (it resumes from here).
+
+    preempt_schedule_irq(context->eflags);
 }
\ No newline at end of file
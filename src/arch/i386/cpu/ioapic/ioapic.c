@@ -1,5 +1,302 @@
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <arch/align.h>
 #include <arch/cpu/cpu.h>
+#include <arch/cpu/io.h>
 #include <arch/cpu/ioapic.h>
-#include <kernel/printk.h>
\ No newline at end of file
+#include <arch/cpu/percpu.h>
+#include <arch/cpu/smp.h>
+#include <arch/kernel/mm/vm.h>
+#include <arch/mmu.h>
+#include <kernel/printk.h>
+#include <kernel/spinlock.h>
+#include <platform/acpi.h>
+#include <platform/pic.h>
+
+/*
+ * Interrupt mode configuration register, present on MP systems booting in PIC mode: it must be switched for the
+ * interrupts to reach the local apics instead of the 8259.
+ */
+
+#define IMCR_SELECT_PORT 0x22
+#define IMCR_DATA_PORT 0x23
+#define IMCR_REGISTER 0x70
+#define IMCR_ROUTE_THROUGH_APIC 0x1
+
+/*
+ * Routing of an irq: the io apic pin it is connected to, the polarity and trigger mode bits of its redirection entry
+ * and the cpu it is delivered to (its index in cpu_data, IOAPIC_CPU_ANY until one is chosen).
+ */
+
+typedef struct ioapic_irq {
+        ioapic_t *ioapic;
+        uint32_t pin;
+        uint32_t global_system_interrupt;
+        uint32_t flags;
+        size_t cpu;
+        bool valid;
+        bool enabled;
+} ioapic_irq_t;
+
+size_t num_ioapics = 0;
+static ioapic_t ioapics[IOAPIC_MAX];
+static ioapic_irq_t irqs[IOAPIC_MAX_IRQS];
+
+/*
+ * Next candidate for irqs routed to IOAPIC_CPU_ANY, so that they are spread round robin over the online cpus.
+ */
+
+static size_t next_cpu = 0;
+
+/*
+ * Serializes the accesses to the registers (selecting a register and accessing it are two separate writes) and to irqs.
+ */
+
+static spinlock_t ioapic_lock = {
+        name: "ioapic",
+        lock: 0,
+};
+
+static uint32_t ioapic_read(ioapic_t *ioapic, uint32_t reg) {
+        volatile uint32_t *base = (volatile uint32_t*) ioapic->address;
+        base[IOAPIC_REGISTER_SELECT / sizeof(uint32_t)] = reg;
+        return base[IOAPIC_WINDOW / sizeof(uint32_t)];
+}
+
+static void ioapic_write(ioapic_t *ioapic, uint32_t reg, uint32_t value) {
+        volatile uint32_t *base = (volatile uint32_t*) ioapic->address;
+        base[IOAPIC_REGISTER_SELECT / sizeof(uint32_t)] = reg;
+        base[IOAPIC_WINDOW / sizeof(uint32_t)] = value;
+}
+
+static ioapic_t* gsi_to_ioapic(uint32_t gsi) {
+        for (size_t i = 0; i < num_ioapics; i++) {
+                if (gsi >= ioapics[i].global_system_interrupt_base && gsi < ioapics[i].global_system_interrupt_base + ioapics[i].num_pins) {
+                        return &ioapics[i];
+                }
+        }
+        return NULL;
+}
+
+/*
+ * Converts the flags of an interrupt override (the MADT and the MP table share the encoding) to redirection entry bits.
+ * Conforming to the bus specification means active high and edge triggered for the ISA bus.
+ */
+
+static uint32_t override_flags(uint16_t flags) {
+        uint32_t entry_flags = IOAPIC_REDIRECTION_POLARITY_ACTIVE_HIGH | IOAPIC_REDIRECTION_TRIGGER_MODE_EDGE;
+        if ((flags & ACPI_MADT_INTERRUPT_FLAGS_POLARITY_MASK) == ACPI_MADT_INTERRUPT_FLAGS_POLARITY_ACTIVE_LOW) {
+                entry_flags |= IOAPIC_REDIRECTION_POLARITY_ACTIVE_LOW;
+        }
+        if (((flags >> ACPI_MADT_INTERRUPT_FLAGS_TRIGGER_MODE_SHIFT) & ACPI_MADT_INTERRUPT_FLAGS_TRIGGER_MODE_MASK) == ACPI_MADT_INTERRUPT_FLAGS_TRIGGER_MODE_LEVEL_TRIGGERED) {
+                entry_flags |= IOAPIC_REDIRECTION_TRIGGER_MODE_LEVEL;
+        }
+        return entry_flags;
+}
+
+static void set_irq_route(uint8_t irq, uint32_t gsi, uint32_t flags) {
+        ioapic_t *ioapic = gsi_to_ioapic(gsi);
+        irqs[irq].valid = ioapic != NULL;
+        if (ioapic == NULL) {
+                return;
+        }
+        irqs[irq].ioapic = ioapic;
+        irqs[irq].pin = gsi - ioapic->global_system_interrupt_base;
+        irqs[irq].global_system_interrupt = gsi;
+        irqs[irq].flags = flags;
+}
+
+/*
+ * Writes the redirection entry of irq. The high dword (the destination) is written first so that an unmasked entry
+ * never points to a stale destination. Must be called with ioapic_lock held.
+ */
+
+static void write_redirection_entry(uint8_t irq) {
+        ioapic_irq_t *route = &irqs[irq];
+        uint32_t low = IOAPIC_IRQ_VECTOR(irq) | IOAPIC_REDIRECTION_DELIVERY_MODE_FIXED | IOAPIC_REDIRECTION_DESTINATION_MODE_PHYSICAL | route->flags;
+        if (!route->enabled) {
+                low |= IOAPIC_REDIRECTION_MASKED;
+        }
+        uint32_t high = (route->cpu == IOAPIC_CPU_ANY ? 0 : cpu_data[route->cpu].lapic_id) << IOAPIC_REDIRECTION_DESTINATION_SHIFT;
+        ioapic_write(route->ioapic, IOAPIC_REDIRECTION_TABLE_REGISTER(route->pin) + 1, high);
+        ioapic_write(route->ioapic, IOAPIC_REDIRECTION_TABLE_REGISTER(route->pin), low);
+}
+
+/*
+ * Returns the next online cpu after the last one picked. Must be called with ioapic_lock held.
+ */
+
+static size_t pick_cpu() {
+        for (size_t i = 0; i < num_cpus; i++) {
+                size_t candidate = (next_cpu + i) % num_cpus;
+                if (cpumask_test(&cpu_online_mask, candidate)) {
+                        next_cpu = candidate + 1;
+                        return candidate;
+                }
+        }
+        return this_cpu_read(cpu_index);
+}
+
+/*
+ * Builds the irq routes: ISA irqs are identity mapped to global system interrupts unless the firmware overrides them
+ * (MADT interrupt source overrides, or the interrupt entries of the MP table, which only describe one io apic), an ISA
+ * irq whose global system interrupt was taken by an override is left unrouted. Higher irqs are PCI ones: active low and
+ * level triggered.
+ */
+
+static void build_irq_routes(void) {
+        bool overridden[IOAPIC_ISA_IRQS] = {false};
+        for (size_t irq = 0; irq < IOAPIC_MAX_IRQS; irq++) {
+                irqs[irq].cpu = IOAPIC_CPU_ANY;
+                irqs[irq].enabled = false;
+                if (irq < IOAPIC_ISA_IRQS) {
+                        set_irq_route(irq, irq, IOAPIC_REDIRECTION_POLARITY_ACTIVE_HIGH | IOAPIC_REDIRECTION_TRIGGER_MODE_EDGE);
+                }
+                else {
+                        set_irq_route(irq, irq, IOAPIC_REDIRECTION_POLARITY_ACTIVE_LOW | IOAPIC_REDIRECTION_TRIGGER_MODE_LEVEL);
+                }
+        }
+        size_t num_overrides = acpi ? acpi_num_interrupt_source_overrides : mp_num_irq_overrides;
+        for (size_t i = 0; i < num_overrides; i++) {
+                uint8_t source = acpi ? acpi_interrupt_source_overrides[i].source : mp_irq_overrides[i].source;
+                uint32_t gsi = acpi ? acpi_interrupt_source_overrides[i].global_system_interrupt : mp_irq_overrides[i].global_system_interrupt;
+                uint16_t flags = acpi ? acpi_interrupt_source_overrides[i].flags : mp_irq_overrides[i].flags;
+                if (source >= IOAPIC_ISA_IRQS) {
+                        continue;
+                }
+                set_irq_route(source, gsi, override_flags(flags));
+                overridden[source] = true;
+        }
+        for (size_t irq = 0; irq < IOAPIC_ISA_IRQS; irq++) {
+                if (overridden[irq]) {
+                        continue;
+                }
+                for (size_t other = 0; other < IOAPIC_ISA_IRQS; other++) {
+                        if (overridden[other] && irqs[other].valid && irqs[other].global_system_interrupt == irqs[irq].global_system_interrupt) {
+                                irqs[irq].valid = false;
+                        }
+                }
+        }
+}
+
+/*
+ * Finds the io apics (from the MADT or the single one of the MP table), masks all their inputs and builds the irq routes.
+ * The 8259 is masked and, if needed, disconnected with the IMCR: from now on device interrupts go through the io apics.
+ * Must be called by the BSP after lapic_init(). Returns -1 if there is no io apic.
+ */
+
+int ioapic_init() {
+        if (acpi) {
+                for (size_t i = 0; i < acpi_num_io_apics && num_ioapics < IOAPIC_MAX; i++) {
+                        ioapics[num_ioapics].id = acpi_io_apics[i].id;
+                        ioapics[num_ioapics].address = (uint32_t*) acpi_io_apics[i].address;
+                        ioapics[num_ioapics].global_system_interrupt_base = acpi_io_apics[i].global_system_interrupt_base;
+                        num_ioapics++;
+                }
+        }
+        else if (io_apic_address) {
+                ioapics[0].address = (uint32_t*) io_apic_address;
+                ioapics[0].global_system_interrupt_base = 0;
+                num_ioapics = 1;
+        }
+        if (num_ioapics == 0) {
+                return -1;
+        }
+        for (size_t i = 0; i < num_ioapics; i++) {
+                ioapic_t *ioapic = &ioapics[i];
+
+                // The io apic the cpu enumeration code found was already identity mapped by arch_main().
+
+                phys_addr_t page = PAGE_ROUND_DOWN((phys_addr_t) ioapic->address);
+                if (page != PAGE_ROUND_DOWN(io_apic_address) && map_page(page, page, PROT_PRESENT | PROT_READ_WRITE | PROT_KERN | PROT_CACHE_DISABLE, false)) {
+                        printk("[KERNEL]: Failed to map io apic %x, ignoring its interrupts.\n", ioapic->address);
+                        ioapic->num_pins = 0;
+                        continue;
+                }
+                if (!acpi) {
+                        ioapic->id = ioapic_read(ioapic, IOAPIC_ID_REGISTER) >> 24;
+                }
+                ioapic->num_pins = IOAPIC_VERSION_MAX_REDIRECTION_ENTRY(ioapic_read(ioapic, IOAPIC_VERSION_REGISTER)) + 1;
+                for (uint32_t pin = 0; pin < ioapic->num_pins; pin++) {
+                        ioapic_write(ioapic, IOAPIC_REDIRECTION_TABLE_REGISTER(pin), IOAPIC_REDIRECTION_MASKED);
+                }
+                printk("[KERNEL]: I/O apic %x at %x: %d pins, global system interrupts from %d.\n", ioapic->id, ioapic->address, ioapic->num_pins, ioapic->global_system_interrupt_base);
+        }
+        build_irq_routes();
+        pic_disable_all_irq_lines();
+        if (mp_imcr_present) {
+                outb(IMCR_SELECT_PORT, IMCR_REGISTER);
+                outb(IMCR_DATA_PORT, inb(IMCR_DATA_PORT) | IMCR_ROUTE_THROUGH_APIC);
+        }
+        return 0;
+}
+
+/*
+ * Delivers irq to the cpu with the given index, or to the next online cpu (round robin) if cpu is IOAPIC_CPU_ANY.
+ * Takes effect right away if the irq is enabled. Returns -1 if the irq is not routed to an io apic or cpu is not online.
+ */
+
+int ioapic_set_affinity(uint8_t irq, size_t cpu) {
+        if (irq >= IOAPIC_MAX_IRQS || (cpu != IOAPIC_CPU_ANY && (cpu >= num_cpus || !cpumask_test(&cpu_online_mask, cpu)))) {
+                return -1;
+        }
+        uint32_t eflags = lock_irqsave(&ioapic_lock);
+        if (!irqs[irq].valid) {
+                unlock_irqrestore(&ioapic_lock, eflags);
+                return -1;
+        }
+        irqs[irq].cpu = cpu == IOAPIC_CPU_ANY ? pick_cpu() : cpu;
+        write_redirection_entry(irq);
+        unlock_irqrestore(&ioapic_lock, eflags);
+        return 0;
+}
+
+/*
+ * Unmasks irq. An irq without a destination yet gets one round robin. The handler must be registered for
+ * IOAPIC_IRQ_VECTOR(irq) first. Returns -1 if the irq is not routed to an io apic.
+ */
+
+int ioapic_enable_irq(uint8_t irq) {
+        if (irq >= IOAPIC_MAX_IRQS) {
+                return -1;
+        }
+        uint32_t eflags = lock_irqsave(&ioapic_lock);
+        if (!irqs[irq].valid) {
+                unlock_irqrestore(&ioapic_lock, eflags);
+                return -1;
+        }
+        if (irqs[irq].cpu == IOAPIC_CPU_ANY) {
+                irqs[irq].cpu = pick_cpu();
+        }
+        irqs[irq].enabled = true;
+        write_redirection_entry(irq);
+        unlock_irqrestore(&ioapic_lock, eflags);
+        return 0;
+}
+
+int ioapic_disable_irq(uint8_t irq) {
+        if (irq >= IOAPIC_MAX_IRQS) {
+                return -1;
+        }
+        uint32_t eflags = lock_irqsave(&ioapic_lock);
+        if (!irqs[irq].valid) {
+                unlock_irqrestore(&ioapic_lock, eflags);
+                return -1;
+        }
+        irqs[irq].enabled = false;
+        write_redirection_entry(irq);
+        unlock_irqrestore(&ioapic_lock, eflags);
+        return 0;
+}
+
+/*
+ * Returns the index of the cpu irq is delivered to, IOAPIC_CPU_ANY if it has none.
+ */
+
+size_t ioapic_irq_cpu(uint8_t irq) {
+        if (irq >= IOAPIC_MAX_IRQS || !irqs[irq].valid) {
+                return IOAPIC_CPU_ANY;
+        }
+        return irqs[irq].cpu;
+}
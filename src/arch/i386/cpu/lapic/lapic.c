@@ -7,12 +7,12 @@
 
 void lapic_write(uint32_t reg, uint32_t value) {
         uint32_t volatile *local_apic_p = (uint32_t volatile*) local_apic_address;
-        *(uint32_t*) ((size_t) local_apic_p + reg) = value;
+        *(uint32_t volatile*) ((size_t) local_apic_p + reg) = value;
 }
 
 uint32_t lapic_read(uint32_t reg) {
         uint32_t volatile *local_apic_p = (uint32_t volatile*) local_apic_address;
-        return *(uint32_t*) ((size_t) local_apic_p + reg);    
+        return *(uint32_t volatile*) ((size_t) local_apic_p + reg);    
 }
 
 /*
@@ -26,12 +26,32 @@ void lapic_init() {
         lapic_write(LAPIC_SPURIOUS_INTERRUPT_VECTOR_REGISTER, 0x1FF);
 }
 
+/*
+ * The destination and the command are two writes: an interrupt handler sending its own IPI in between would change the
+ * destination, and a migration would split them over two local apics, so interrupts stay disabled across both.
+ */
+
 void lapic_send_ipi(uint8_t destination_local_apic_id, uint32_t icr_low) {
+        uint32_t eflags = arch_irq_save();
         lapic_write(LAPIC_INTERRUPT_COMMAND_REGISTER_1, destination_local_apic_id << 24);
-        lapic_write(LAPIC_INTERRUPT_COMMAND_REGISTER_0, icr_low);    
+        lapic_write(LAPIC_INTERRUPT_COMMAND_REGISTER_0, icr_low);
+        arch_irq_restore(eflags);
+}
+
+/*
+ * Spins until the last IPI sent from this cpu has been accepted.
+ */
+
+void lapic_wait_ipi_delivery() {
+        while (LAPIC_ICR_DELIVERY_STATUS(lapic_read(LAPIC_INTERRUPT_COMMAND_REGISTER_0)) != LAPIC_ICR_DELIVERY_STATUS_IDLE) {
+                arch_pause();
+        }
 }
 
+/*
+ * Signals the end of the interrupt being serviced. Must not be sent for the spurious interrupt vector.
+ */
 
 void lapic_send_eoi() {
-        
+        lapic_write(LAPIC_EOI_REGISTER, 0);
 }
\ No newline at end of file
@@ -0,0 +1,176 @@
+#include <cpuid.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <arch/cpu/cpu.h>
+#include <arch/cpu/lapic.h>
+#include <arch/cpu/percpu.h>
+#include <arch/cpu/topology.h>
+#include <arch/cpu/tsc.h>
+#include <kernel/assert.h>
+#include <kernel/clockevents.h>
+#include <kernel/clocksource.h>
+#include <kernel/interrupt.h>
+#include <kernel/printk.h>
+#include <kernel/tick.h>
+
+/*
+ * Length of the calibration against the clocksource.
+ */
+
+#define CALIBRATION_MS 10
+
+/*
+ * Counts per second of the local apic timers (with the divider used by the kernel). It is measured once by the BSP:
+ * every cpu is assumed to have the same bus frequency.
+ */
+
+uint32_t lapic_timer_frequency = 0;
+bool tsc_deadline = false;
+
+// Length of a periodic tick in local apic timer counts.
+
+static uint32_t tick_count = 0;
+
+DEFINE_PER_CPU(uint32_t, lapic_timer_mode);
+DEFINE_PER_CPU(clock_event_device_t, lapic_clockevent);
+
+static int lapic_timer_set_periodic(clock_event_device_t *device) {
+        (void) device;
+        lapic_write(LAPIC_LVT_TIMER_REGISTER_OFFEST, LAPIC_TIMER_VECTOR | LAPIC_LVT_TIMER_MODE_PERIODIC);
+        lapic_write(LAPIC_INITIAL_COUNT_REGISTER, tick_count);
+        return 0;
+}
+
+static int lapic_timer_set_oneshot(clock_event_device_t *device) {
+        (void) device;
+        if (this_cpu_read(lapic_timer_mode) == LAPIC_TIMER_MODE_TSC_DEADLINE) {
+                lapic_write(LAPIC_LVT_TIMER_REGISTER_OFFEST, LAPIC_TIMER_VECTOR | LAPIC_LVT_TIMER_MODE_TSC_DEADLINE);
+
+                // The write to the memory mapped LVT must be done before a deadline is armed.
+
+                asm volatile("mfence" : : : "memory");
+        }
+        else {
+                lapic_write(LAPIC_LVT_TIMER_REGISTER_OFFEST, LAPIC_TIMER_VECTOR | LAPIC_LVT_TIMER_MODE_ONE_SHOT);
+        }
+        return 0;
+}
+
+static int lapic_timer_shutdown(clock_event_device_t *device) {
+        (void) device;
+        lapic_write(LAPIC_LVT_TIMER_REGISTER_OFFEST, LAPIC_LVT_MASKED | LAPIC_TIMER_VECTOR);
+        lapic_write(LAPIC_INITIAL_COUNT_REGISTER, 0);
+        if (this_cpu_read(lapic_timer_mode) == LAPIC_TIMER_MODE_TSC_DEADLINE) {
+                write_msr(MSR_IA32_TSC_DEADLINE, 0);
+        }
+        return 0;
+}
+
+/*
+ * Writing the initial count (or the deadline) replaces the event that was programmed, if any.
+ */
+
+static int lapic_timer_set_next_event(uint64_t delta, clock_event_device_t *device) {
+        (void) device;
+        if (this_cpu_read(lapic_timer_mode) == LAPIC_TIMER_MODE_TSC_DEADLINE) {
+                write_msr(MSR_IA32_TSC_DEADLINE, read_tsc() + ((delta * tsc_frequency) / NSEC_PER_SEC));
+        }
+        else {
+                lapic_write(LAPIC_INITIAL_COUNT_REGISTER, (uint32_t) ((delta * lapic_timer_frequency) / NSEC_PER_SEC) + 1);
+        }
+        return 0;
+}
+
+static int lapic_timer_interrupt(interrupt_context_t *context, void *dev_id) {
+        (void) context;
+        (void) dev_id;
+        clock_event_device_t *device = this_cpu_ptr(lapic_clockevent);
+        if (device->event_handler) {
+                device->event_handler(device);
+        }
+        return INTERRUPT_HANDLED;
+}
+
+static interrupt_action_t lapic_timer_action = {
+        handler: lapic_timer_interrupt,
+        dev_id: NULL,
+        flags: 0,
+};
+
+/*
+ * Measures the local apic timer frequency against the clocksource (the TSC when there is one) with interrupts disabled and
+ * registers the timer interrupt handler. Must be called once by the BSP after lapic_init() and before lapic_timer_init().
+ * Returns -1 if the local apic timer did not count.
+ */
+
+int lapic_timer_calibrate() {
+        unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+        __get_cpuid(CPUID_LEAF_FEATURES, &eax, &ebx, &ecx, &edx);
+        tsc_deadline = (ecx & CPUID_FEATURES_ECX_TSC_DEADLINE) && tsc_frequency != 0;
+        uint32_t eflags = arch_irq_save();
+        lapic_write(LAPIC_DIVIDE_CONFIGURATION_REGISTER, LAPIC_DIVIDE_BY_16);
+        lapic_write(LAPIC_LVT_TIMER_REGISTER_OFFEST, LAPIC_LVT_MASKED | LAPIC_TIMER_VECTOR);
+        lapic_write(LAPIC_INITIAL_COUNT_REGISTER, 0xFFFFFFFF);
+        uint64_t start = ktime_get_ns();
+        uint64_t end;
+        while ((end = ktime_get_ns()) - start < CALIBRATION_MS * NSEC_PER_MSEC) {
+                arch_pause();
+        }
+        uint32_t counted = 0xFFFFFFFF - lapic_read(LAPIC_CURRENT_COUNT_REGISTER);
+        lapic_write(LAPIC_INITIAL_COUNT_REGISTER, 0);
+        arch_irq_restore(eflags);
+        if (counted == 0) {
+                return -1;
+        }
+        lapic_timer_frequency = (uint32_t) (((uint64_t) counted * NSEC_PER_SEC) / (end - start));
+        tick_count = lapic_timer_frequency / TICK_HZ;
+        if (register_interrupt_handler(LAPIC_TIMER_VECTOR, &lapic_timer_action)) {
+                panic("[KERNEL]: Could not register interrupt handler! File: %s line: %d function: %s\n", __FILENAME__, __LINE__, __func__);
+        }
+        printk("[KERNEL]: Local apic timer: %d kHz, TSC deadline mode %s.\n", lapic_timer_frequency / 1000, tsc_deadline ? "supported" : "not supported");
+        return 0;
+}
+
+/*
+ * Registers the local apic timer of the calling cpu as its clock event device, which starts its tick. In periodic mode the
+ * timer only offers a periodic tick, otherwise a one shot one (on the TSC deadline if asked and supported, falling back
+ * to the one shot mode) which lets the cpu stop its tick while idle. Returns -1 if the timer was not calibrated.
+ */
+
+int lapic_timer_init(uint32_t mode) {
+        if (tick_count == 0) {
+                return -1;
+        }
+        if (mode == LAPIC_TIMER_MODE_TSC_DEADLINE && !tsc_deadline) {
+                mode = LAPIC_TIMER_MODE_ONE_SHOT;
+        }
+        this_cpu_write(lapic_timer_mode, mode);
+        lapic_write(LAPIC_DIVIDE_CONFIGURATION_REGISTER, LAPIC_DIVIDE_BY_16);
+        clock_event_device_t *device = this_cpu_ptr(lapic_clockevent);
+        device->name = "lapic";
+        device->features = mode == LAPIC_TIMER_MODE_PERIODIC ? CLOCK_EVT_FEAT_PERIODIC : CLOCK_EVT_FEAT_ONESHOT;
+        device->min_delta_ns = LAPIC_TIMER_MIN_DELTA_NS;
+
+        // Longest delays whose conversion to counts or cycles neither overflows nor exceeds the 32 bits initial count.
+
+        if (mode == LAPIC_TIMER_MODE_TSC_DEADLINE) {
+                device->max_delta_ns = 0xFFFFFFFFFFFFFFFFULL / tsc_frequency;
+        }
+        else {
+                device->max_delta_ns = (0xFFFFFFFEULL * NSEC_PER_SEC) / lapic_timer_frequency;
+        }
+        device->set_state_periodic = lapic_timer_set_periodic;
+        device->set_state_oneshot = lapic_timer_set_oneshot;
+        device->set_state_shutdown = lapic_timer_shutdown;
+        device->set_next_event = lapic_timer_set_next_event;
+        return clockevents_register_device(device);
+}
+
+/*
+ * Stops the tick of the calling cpu.
+ */
+
+void lapic_timer_stop() {
+        clockevents_switch_state(this_cpu_ptr(lapic_clockevent), CLOCK_EVT_STATE_SHUTDOWN);
+}
@@ -0,0 +1,77 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <arch/align.h>
+#include <arch/cpu/cpu.h>
+#include <arch/cpu/percpu.h>
+#include <arch/cpu/smp.h>
+#include <arch/kernel/mm/vm.h>
+#include <arch/mmu.h>
+#include <kernel/assert.h>
+#include <kernel/mm/pm.h>
+#include <lib/string.h>
+
+/*
+ * Offset to add to the address of a per cpu variable to get the copy of the cpu at the given index.
+ * It is also the base of the %gs segment of that cpu (see gdt_init()).
+ */
+
+uintptr_t per_cpu_offset[MAX_CPUS];
+
+DEFINE_PER_CPU(uintptr_t, this_cpu_offset);
+DEFINE_PER_CPU(size_t, cpu_index);
+DEFINE_PER_CPU(cpu_data_t*, cpu);
+
+static size_t percpu_size(void) {
+        return (size_t) &_PERCPU_END_ - (size_t) &_PERCPU_START_;
+}
+
+/*
+ * Copies the template in area and initializes the variables every cpu must have.
+ * The variables are written through the area itself as the %gs segment of that cpu does not exist yet.
+ */
+
+static void percpu_setup_area(size_t index, void *area) {
+        uintptr_t offset = (uintptr_t) area - (uintptr_t) &_PERCPU_START_;
+        memcpy(area, (void*) &_PERCPU_START_, percpu_size());
+        per_cpu_offset[index] = offset;
+        *per_cpu_ptr(this_cpu_offset, index) = offset;
+        *per_cpu_ptr(cpu_index, index) = index;
+        *per_cpu_ptr(cpu, index) = &cpu_data[index];
+}
+
+/*
+ * The BSP area is reserved in the kernel .bss by the linker script since this runs before the memory managers.
+ * Must be called after smp_init() and before gdt_init().
+ */
+
+void percpu_init_bsp() {
+        cpu_data_t *bsp = get_cpu_data(get_lapic_id());
+        if (!bsp) {
+                panic("[KERNEL]: Unknown local apic id %x! File: %s line: %d function: %s\n", get_lapic_id(), __FILENAME__, __LINE__, __func__);
+        }
+        percpu_setup_area((size_t) (bsp - cpu_data), (void*) &_PERCPU_BSP_START_);
+}
+
+/*
+ * Allocates and maps the areas of every AP starting at PERCPU_AREAS_START. Must be called after vm_init() and before starting the APs.
+ */
+
+void percpu_init_aps() {
+        size_t area_size = PAGE_ROUND_UP(percpu_size());
+        for (size_t i = 0; i < num_cpus; i++) {
+                if (cpu_data[i].bsp) {
+                        continue;
+                }
+                virt_addr_t area = PERCPU_AREAS_START + (i * area_size);
+                for (size_t page = 0; page < area_size; page += PAGE_SIZE) {
+                        phys_addr_t frame = get_free_frame();
+                        if (frame == (phys_addr_t) -1) {
+                                panic("[KERNEL]: Failed to allocate memory! File: %s line: %d function: %s\n", __FILENAME__, __LINE__, __func__);
+                        }
+                        if (map_page(frame, area + page, PROT_PRESENT | PROT_READ_WRITE | PROT_KERN, false)) {
+                                panic("[KERNEL]: Failed to map per cpu area! File: %s line: %d function: %s\n", __FILENAME__, __LINE__, __func__);
+                        }
+                }
+                percpu_setup_area(i, (void*) area);
+        }
+}
\ No newline at end of file
@@ -4,12 +4,14 @@
 #include <stdint.h>
 #include <arch/align.h>
 #include <arch/cpu/cpu.h>
+#include <arch/cpu/percpu.h>
 #include <arch/cpu/smp.h>
 #include <arch/kernel/mm/vm.h>
 #include <arch/mmu.h>
 #include <kernel/bootmem.h>
 #include <kernel/printk.h>
 #include <lib/string.h>
+#include <platform/acpi.h>
 
 cpu_data_t *cpu_data;
 size_t num_cpus = 0;
@@ -17,6 +19,10 @@ phys_addr_t local_apic_address = 0;
 phys_addr_t io_apic_address = 0;
 bool hyperthreading = false;
 bool smp = false;
+cpumask_t cpu_online_mask;
+size_t mp_num_irq_overrides = 0;
+mp_irq_override_t mp_irq_overrides[MP_MAX_IRQ_OVERRIDES];
+bool mp_imcr_present = false;
 
 static uint8_t checksum(void* addr, size_t len) {
         uint8_t checksum = 0;
@@ -45,8 +51,72 @@ static void check_hyperthreading(void) {
         return;
 }
 
+/*
+ * Returns the initial local apic identifier of the calling cpu (cpuid leaf 1, ebx bits 31 - 24).
+ */
+
+uint8_t get_lapic_id() {
+        unsigned int unused, ebx = 0;
+        __get_cpuid(1, &unused, &ebx, &unused, &unused);
+        return ebx >> 24;
+}
+
+/*
+ * Local apic identifiers are not guaranteed to be contiguous so the cpu_data array must be searched.
+ * Returns NULL if no cpu with the given identifier was enumerated.
+ */
+
+cpu_data_t* get_cpu_data(uint8_t lapic_id) {
+        if (!smp) {
+                return cpu_data;
+        }
+        for (size_t i = 0; i < num_cpus; i++) {
+                if (cpu_data[i].lapic_id == lapic_id) {
+                        return &cpu_data[i];
+                }
+        }
+        return NULL;
+}
+
+/*
+ * Initializes the cpu_data structures from the local apics enumerated in the ACPI MADT.
+ * Unlike the MP tables every logical processor (hyperthreads included) has its own entry.
+ */
+
+static int init_cpu_data_acpi(void) {
+        if (acpi_num_local_apics == 1) {
+                return -1;
+        }
+        check_hyperthreading();
+        num_cpus = acpi_num_local_apics;
+        if (num_cpus > MAX_CPUS) {
+                num_cpus = MAX_CPUS;
+        }
+        cpu_data = (cpu_data_t*) b_malloc(sizeof(cpu_data_t) * num_cpus);
+        if (!cpu_data) {
+                panic("[KERNEL]: Failed to allocate memory! File: %s line: %d function: %s\n", __FILENAME__, __LINE__, __func__);
+        }
+        memset(cpu_data, 0x0, sizeof(cpu_data_t) * num_cpus);
+        uint8_t bsp_lapic_id = get_lapic_id();
+        for (size_t i = 0; i < num_cpus; i++) {
+                cpu_data[i].lapic_id = acpi_local_apic_ids[i];
+                cpu_data[i].bsp = acpi_local_apic_ids[i] == bsp_lapic_id;
+        }
+        local_apic_address = acpi_local_apic_address;
+        if (acpi_num_io_apics) {
+                io_apic_address = acpi_io_apics[0].address;
+        }
+        return 0;
+}
+
+/*
+ * The bus entries come before the interrupt entries in the MP table, so the ISA buses are known by the time the
+ * interrupt entries referring to them are found.
+ */
+
 static int init_cpu_data(uint8_t *entry, size_t num_entries) {
         uint8_t *saved_entry = entry;
+        uint32_t isa_buses[256 / 32] = {0};
         for (size_t i = 0; i < num_entries; i++) {
                 switch(*entry) {
                         case MP_CONFIGURATION_TABLE_PROCESSOR_ENTRY_TYPE:
@@ -57,6 +127,10 @@ static int init_cpu_data(uint8_t *entry, size_t num_entries) {
                                 entry += sizeof(mp_configuration_table_processor_entry_t);
                                 break;
                         case MP_CONFIGURATION_TABLE_BUS_ENTRY_TYPE:
+                                mp_configuration_table_bus_entry_t *bus_entry = (mp_configuration_table_bus_entry_t*) entry;
+                                if (memcmp(bus_entry->bus_type_string, "ISA", 3) == 0) {
+                                        isa_buses[bus_entry->bus_id / 32] |= 1U << (bus_entry->bus_id % 32);
+                                }
                                 entry += sizeof(mp_configuration_table_bus_entry_t);
                                 break;
                         case MP_CONFIGURATION_TABLE_IO_APIC_ENTRY_TYPE:
@@ -67,6 +141,13 @@ static int init_cpu_data(uint8_t *entry, size_t num_entries) {
                                 entry += sizeof(mp_configuration_table_io_apic_entry_t);
                                 break;
                         case  MP_CONFIGURATION_TABLE_IO_APIC_INTERRUPT_ENTRY:
+                                mp_configuration_table_io_apic_interrupt_entry_t *interrupt_entry = (mp_configuration_table_io_apic_interrupt_entry_t*) entry;
+                                if (interrupt_entry->interrupt_type == MP_CONFIGURATION_TABLE_IO_APIC_INTERRUPT_ENTRY_TYPE_INT && (isa_buses[interrupt_entry->source_bus_id / 32] & (1U << (interrupt_entry->source_bus_id % 32))) && mp_num_irq_overrides < MP_MAX_IRQ_OVERRIDES) {
+                                        mp_irq_overrides[mp_num_irq_overrides].source = interrupt_entry->source_bus_irq;
+                                        mp_irq_overrides[mp_num_irq_overrides].global_system_interrupt = interrupt_entry->destination_io_apic_intin;
+                                        mp_irq_overrides[mp_num_irq_overrides].flags = interrupt_entry->interrupt_flags;
+                                        mp_num_irq_overrides++;
+                                }
                                 entry += sizeof(mp_configuration_table_io_apic_interrupt_entry_t);
                                 break;
                         case  MP_CONFIGURATION_TABLE_LOCAL_APIC_INTERRUPT_ENTRY:
@@ -90,40 +171,32 @@ static int init_cpu_data(uint8_t *entry, size_t num_entries) {
         }
 
         /*
-        * As read on the Intel developer's manual and on the Osdev forums https://forum.osdev.org/
-        * if the cpu supports hyperthreading the total number of cpus on the systems is simply the
-        * total count of physical cores multiplied by 2 (each core has 2 threads).
+        * Only the processors listed by the firmware are started. Hyperthread siblings missing from the MP tables are not
+        * guessed: their local apic identifiers are not known to exist, the ACPI MADT lists every logical processor and the
+        * topology comes from cpuid (see topology.c).
         */
 
         check_hyperthreading();
-        if (hyperthreading) {
-                num_cpus *= 2;
+        if (num_cpus > MAX_CPUS) {
+                num_cpus = MAX_CPUS;
         }
         cpu_data = (cpu_data_t*) b_malloc(sizeof(cpu_data_t) * num_cpus);
         if (!cpu_data) {
                 panic("[KERNEL]: Failed to allocate memory! File: %s line: %d function: %s\n", __FILENAME__, __LINE__, __func__);
         }
         memset(cpu_data, 0x0, sizeof(cpu_data_t) * num_cpus);
+        cpu_data_t *next_cpu = cpu_data;
+        cpu_data_t *end_cpu = cpu_data + num_cpus;
         for (size_t i = 0; i < num_entries; i++) {
                 switch(*saved_entry) {
                         case MP_CONFIGURATION_TABLE_PROCESSOR_ENTRY_TYPE:
                                 mp_configuration_table_processor_entry_t *processor_entry = (mp_configuration_table_processor_entry_t*) saved_entry;
-                                if (processor_entry->cpu_flags & MP_CONFIGURATION_TABLE_PROCESSOR_ENTRY_CPU_FLAGS_PROCESSOR_USABLE) {
-                                        cpu_data->lapic_id = processor_entry->local_apic_id;
+                                if ((processor_entry->cpu_flags & MP_CONFIGURATION_TABLE_PROCESSOR_ENTRY_CPU_FLAGS_PROCESSOR_USABLE) && next_cpu < end_cpu) {
+                                        next_cpu->lapic_id = processor_entry->local_apic_id;
                                 if ((processor_entry->cpu_flags >> MP_CONFIGURATION_TABLE_PROCESSOR_ENTRY_CPU_FLAGS_PROCESSOR_IS_BSP_SHIFT) & MP_CONFIGURATION_TABLE_PROCESSOR_ENTRY_CPU_FLAGS_PROCESSOR_IS_BSP) {
-                                        cpu_data->bsp = 1;
-                                }
-                                cpu_data++;
-                                /*
-                                * As read on the osdev forums, the local apic identifider of the hyperthreading cpus
-                                * can be assumed to be the last physical core cpu local apic identifier increased by one.
-                                * This was tested on a real machine and even though hacky it works.
-                                */
-                                if (hyperthreading) {
-                                        cpu_data->bsp = 0;
-                                        cpu_data->lapic_id = processor_entry->local_apic_id + 1;
-                                        cpu_data++;
+                                        next_cpu->bsp = 1;
                                 }
+                                next_cpu++;
                                 }
                                 saved_entry += sizeof(mp_configuration_table_processor_entry_t);
                                 break;
@@ -141,7 +214,6 @@ static int init_cpu_data(uint8_t *entry, size_t num_entries) {
                                 break;
                 }
         }
-        cpu_data -= num_cpus;
         return 0;
 }
 
@@ -277,6 +349,7 @@ static int init_cpu_data(uint8_t *entry, size_t num_entries) {
 #endif
 
 /*
+ * If the ACPI MADT was found it is used to enumerate the cpus, otherwise fall back to the MP tables.
  * As per Intel MP specification document search for an MP floating pointer structure at suggested locations:
  * A) In the first Kilobyte of the EBDA if defined or withing the last Kilobyte of the system base memory.
  * EBDA base address is usually specified in the BDA on x86 systems and systemd base memory size is also
@@ -290,6 +363,16 @@ static int init_cpu_data(uint8_t *entry, size_t num_entries) {
 
 void smp_init() {
 
+        // Prefer the ACPI MADT if acpi_init() found one.
+
+        if (acpi) {
+                if (init_cpu_data_acpi()) {
+                        goto failure;
+                }
+                smp = true;
+                return;
+        }
+
         /* 
         * Not checking if the ebda is mapped in virtual memory because implicitly assuming it's in the low 1Mib memory
         * and the kernel boot code maps the first 2Mib atleast.
@@ -336,6 +419,7 @@ void smp_init() {
                                 }
                                 else {
                                         local_apic_address = mp_config->local_apic_address;
+                                        mp_imcr_present = (mp->mp_feature_bytes[1] >> MP_FLOATING_POINTER_STRUCTURE_IMCRP_SHIFT) & MP_FLOATING_POINTER_STRUCTURE_IMCR_PRESENT;
                                         smp = true;
                                         #ifdef DEBUG
                                                 print_table((uint8_t*) (mp_config + 1), mp_config->entry_count);
@@ -355,6 +439,16 @@ void smp_init() {
                 if (!cpu_data) {
                         panic("[KERNEL]: Failed to allocate memory! File: %s line: %d function: %s\n", __FILENAME__, __LINE__, __func__);
                 }
+                memset(cpu_data, 0x0, sizeof(cpu_data_t));
+                num_cpus = 1;
                 cpu_data->bsp = true;
+                cpu_data->lapic_id = get_lapic_id();
                 return;
-}
\ No newline at end of file
+}
+/*
+ * Marks the calling cpu as online. Cpus come online concurrently so the mask is updated atomically.
+ */
+
+void smp_set_cpu_online() {
+        cpumask_set_atomic(&cpu_online_mask, this_cpu_read(cpu_index));
+}
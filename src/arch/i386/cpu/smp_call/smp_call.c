@@ -0,0 +1,190 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <arch/cpu/cpu.h>
+#include <arch/cpu/lapic.h>
+#include <arch/cpu/percpu.h>
+#include <arch/cpu/smp.h>
+#include <arch/cpu/smp_call.h>
+#include <kernel/assert.h>
+#include <kernel/interrupt.h>
+#include <kernel/preempt.h>
+#include <kernel/printk.h>
+
+/*
+ * Every cpu has a lock free queue of the requests it has to run (call_queue, a list of smp_call_t pushed by the other cpus
+ * with cmpxchg and detached at once by the owner with xchg) and owns one request per target cpu (call_requests) so that
+ * issuing a call never allocates memory. A request stays locked until the target is done with it and it is only reused after that.
+ * An IPI is only sent when a request is pushed on an empty queue: otherwise the target already has one pending.
+ */
+
+DEFINE_PER_CPU(smp_call_t*, call_queue);
+DEFINE_PER_CPU(smp_call_t[MAX_CPUS], call_requests);
+
+static bool queue_push(size_t target, smp_call_t *request) {
+        volatile uint32_t *head = (volatile uint32_t*) per_cpu_ptr(call_queue, target);
+        uint32_t old;
+        do {
+                old = *head;
+                request->next = (smp_call_t*) old;
+        } while (arch_atomic_compare_exchange(old, (uint32_t) request, head) != old);
+        return old == 0;
+}
+
+static void request_wait(smp_call_t *request) {
+        while (request->flags & SMP_CALL_LOCKED) {
+                arch_pause();
+        }
+}
+
+static void request_unlock(smp_call_t *request) {
+        arch_compiler_barrier();
+        request->flags = 0;
+}
+
+/*
+ * Runs the requests queued on this cpu in the order they were queued. Asynchronous requests are unlocked before running
+ * them (the function and its argument are copied first) so that their owner can reuse them as soon as possible, synchronous
+ * ones only after the function returned.
+ */
+
+static int smp_call_interrupt(interrupt_context_t *context, void *dev_id) {
+        (void) context;
+        (void) dev_id;
+        smp_call_t *list = (smp_call_t*) arch_atomic_swap(0, (volatile uint32_t*) this_cpu_ptr(call_queue));
+        smp_call_t *ordered = NULL;
+        while (list) {
+                smp_call_t *next = list->next;
+                list->next = ordered;
+                ordered = list;
+                list = next;
+        }
+        while (ordered) {
+                smp_call_t *next = ordered->next;
+                smp_call_func_t function = ordered->function;
+                void *arg = ordered->arg;
+                if (ordered->flags & SMP_CALL_WAIT) {
+                        function(arg);
+                        request_unlock(ordered);
+                }
+                else {
+                        request_unlock(ordered);
+                        function(arg);
+                }
+                ordered = next;
+        }
+        return INTERRUPT_HANDLED;
+}
+
+static interrupt_action_t smp_call_action = {
+        handler: smp_call_interrupt,
+        dev_id: NULL,
+        flags: 0,
+};
+
+void smp_call_init() {
+        if (register_interrupt_handler(SMP_CALL_FUNCTION_VECTOR, &smp_call_action)) {
+                panic("[KERNEL]: Could not register interrupt handler! File: %s line: %d function: %s\n", __FILENAME__, __LINE__, __func__);
+        }
+}
+
+/*
+ * Runs function(arg) on every online cpu in mask, the calling cpu included if it is in mask (locally the function runs
+ * with interrupts disabled, like on the other cpus where it runs from the interrupt handler). If wait is true returns once every
+ * cpu ran the function, otherwise as soon as the requests are queued. When every other cpu is targeted a single broadcast IPI is sent.
+ * Must not be called from interrupt handlers and, when other cpus are targeted, must be called with interrupts enabled:
+ * two cpus waiting on each other with interrupts disabled would never complete.
+ * Returns 0 on success and -1 on invalid arguments.
+ */
+
+int smp_call_function(const cpumask_t *mask, smp_call_func_t function, void *arg, bool wait) {
+        if (mask == NULL || function == NULL) {
+                return -1;
+        }
+
+        // The requests belong to the calling cpu: the caller must neither migrate nor let another thread of this cpu reuse them.
+
+        preempt_disable();
+        size_t self = this_cpu_read(cpu_index);
+        smp_call_t *requests = *this_cpu_ptr(call_requests);
+        cpumask_t remote = {0};
+        cpumask_t ipi = {0};
+        for (size_t i = 0; i < num_cpus; i++) {
+                if (i != self && cpumask_test(mask, i) && cpumask_test(&cpu_online_mask, i)) {
+                        cpumask_set(&remote, i);
+                }
+        }
+
+        // Asynchronous calls issued earlier might still be using the requests.
+
+        for (size_t i = 0; i < num_cpus; i++) {
+                if (cpumask_test(&remote, i)) {
+                        request_wait(&requests[i]);
+                }
+        }
+        uint32_t eflags = arch_irq_save();
+        for (size_t i = 0; i < num_cpus; i++) {
+                if (!cpumask_test(&remote, i)) {
+                        continue;
+                }
+                requests[i].function = function;
+                requests[i].arg = arg;
+                requests[i].flags = SMP_CALL_LOCKED | (wait ? SMP_CALL_WAIT : 0);
+                if (queue_push(i, &requests[i])) {
+                        cpumask_set(&ipi, i);
+                }
+        }
+        size_t ipi_count = cpumask_weight(&ipi);
+        uint32_t icr = SMP_CALL_FUNCTION_VECTOR | LAPIC_ICR_DELIVERY_MODE_FIXED | LAPIC_ICR_DESTINATION_MODE_PHYSICAL | LAPIC_ICR_LEVEL_ASSERT | LAPIC_ICR_TRIGGER_MODE_EDGE;
+        if (ipi_count > 1 && cpumask_weight(&remote) == num_cpus - 1) {
+                lapic_wait_ipi_delivery();
+                lapic_send_ipi(0, icr | LAPIC_ICR_DESTINATION_ALL_EXCLUDING_SELF);
+        }
+        else if (ipi_count > 0) {
+                for (size_t i = 0; i < num_cpus; i++) {
+                        if (cpumask_test(&ipi, i)) {
+                                lapic_wait_ipi_delivery();
+                                lapic_send_ipi(cpu_data[i].lapic_id, icr | LAPIC_ICR_DESTINATION_NO_SHORTHAND);
+                        }
+                }
+        }
+        if (cpumask_test(mask, self)) {
+                function(arg);
+        }
+        arch_irq_restore(eflags);
+        if (wait) {
+                for (size_t i = 0; i < num_cpus; i++) {
+                        if (cpumask_test(&remote, i)) {
+                                request_wait(&requests[i]);
+                        }
+                }
+        }
+        preempt_enable();
+        return 0;
+}
+
+/*
+ * Runs function(arg) on the cpu with the given index. Returns -1 if that cpu is not online.
+ */
+
+int smp_call_function_single(size_t target, smp_call_func_t function, void *arg, bool wait) {
+        if (target >= num_cpus || !cpumask_test(&cpu_online_mask, target)) {
+                return -1;
+        }
+        cpumask_t mask = {0};
+        cpumask_set(&mask, target);
+        return smp_call_function(&mask, function, arg, wait);
+}
+
+/*
+ * Sends the reschedule IPI to the cpu with the given index. The handler is registered by the scheduler. Can be called with
+ * interrupts disabled as it does not wait for the target. Interrupts are disabled so that the delivery wait and the IPI
+ * happen on the same local apic.
+ */
+
+void smp_send_reschedule(size_t target) {
+        uint32_t eflags = arch_irq_save();
+        lapic_wait_ipi_delivery();
+        lapic_send_ipi(cpu_data[target].lapic_id, RESCHEDULE_VECTOR | LAPIC_ICR_DELIVERY_MODE_FIXED | LAPIC_ICR_DESTINATION_MODE_PHYSICAL | LAPIC_ICR_LEVEL_ASSERT | LAPIC_ICR_TRIGGER_MODE_EDGE | LAPIC_ICR_DESTINATION_NO_SHORTHAND);
+        arch_irq_restore(eflags);
+}
@@ -0,0 +1,54 @@
+#include <cpuid.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <arch/cpu/cpu.h>
+#include <arch/cpu/gdt.h>
+#include <arch/cpu/percpu.h>
+#include <arch/cpu/syscall.h>
+#include <arch/cpu/topology.h>
+#include <arch/cpu/tss.h>
+
+extern void sysenter_entry(void);
+
+/*
+ * Set by the BSP when the processor supports SYSENTER/SYSEXIT.
+ */
+
+bool sysenter = false;
+
+/*
+ * Kernel stack pointer saved by arch_enter_user(), restored by arch_leave_user().
+ */
+
+DEFINE_PER_CPU(uint32_t, user_return_esp);
+
+/*
+ * Programs the SYSENTER MSRs of the calling cpu. Must be run by every cpu after gdt_init().
+ * The SYSENTER stack pointer is the address of the cpu task state segment: the entry code loads the real kernel stack
+ * pointer from its esp0 field, so that switching stacks never needs an MSR write.
+ * Returns -1 if the processor does not support SYSENTER.
+ */
+
+int syscall_init() {
+        unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+        __get_cpuid(CPUID_LEAF_FEATURES, &eax, &ebx, &ecx, &edx);
+        if (!(edx & CPUID_FEATURES_EDX_SEP)) {
+                return -1;
+        }
+        write_msr(MSR_SYSENTER_CS, GDT_KERNEL_CODE_OFFSET);
+        write_msr(MSR_SYSENTER_ESP, (uint32_t) this_cpu_ptr(tss));
+        write_msr(MSR_SYSENTER_EIP, (uint32_t) sysenter_entry);
+        return 0;
+}
+
+/*
+ * Called by the scheduler with interrupts disabled, right before switching from prev to next on the calling cpu.
+ */
+
+void user_context_switch(user_context_t *prev, user_context_t *next) {
+        tss_t *tss = this_cpu_ptr(tss);
+        prev->return_esp = this_cpu_read(user_return_esp);
+        prev->esp0 = tss->esp0;
+        this_cpu_write(user_return_esp, next->return_esp);
+        tss->esp0 = next->esp0;
+}
@@ -0,0 +1,192 @@
+#include <cpuid.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <arch/cpu/cpu.h>
+#include <arch/cpu/smp.h>
+#include <arch/cpu/topology.h>
+#include <kernel/printk.h>
+#include <lib/string.h>
+
+/*
+ * Returns the number of bits needed to represent count different identifiers.
+ */
+
+static uint8_t count_to_shift(uint32_t count) {
+        uint8_t shift = 0;
+        while ((1U << shift) < count) {
+                shift++;
+        }
+        return shift;
+}
+
+/*
+ * Fills the topology record of the calling cpu. Must be run by every cpu on itself (after gdt_init()) since cpuid only
+ * describes the processor executing it. Leaf 0xB is preferred as it reports the real x2apic id and the field widths,
+ * otherwise the widths are derived from the logical processor count of leaf 1 and the core count of leaf 4.
+ */
+
+void topology_init() {
+        unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+        cpu_topology_t *topology = &cpu->topology;
+        memset(topology, 0x0, sizeof(cpu_topology_t));
+        __get_cpuid(CPUID_LEAF_VENDOR, &eax, &ebx, &ecx, &edx);
+        uint32_t max_leaf = eax;
+        __get_cpuid(CPUID_LEAF_FEATURES, &eax, &ebx, &ecx, &edx);
+        topology->apic_id = ebx >> 24;
+        bool htt = edx & CPUID_FEATURES_EDX_HTT;
+        uint32_t logical_per_package = htt ? (ebx >> 16) & 0xFF : 1;
+        bool extended_topology = false;
+        if (max_leaf >= CPUID_LEAF_EXTENDED_TOPOLOGY) {
+                __cpuid_count(CPUID_LEAF_EXTENDED_TOPOLOGY, 0, eax, ebx, ecx, edx);
+                if (ebx != 0) {
+                        extended_topology = true;
+                        topology->apic_id = edx;
+                        for (uint32_t level = 0; ; level++) {
+                                __cpuid_count(CPUID_LEAF_EXTENDED_TOPOLOGY, level, eax, ebx, ecx, edx);
+                                uint8_t type = (ecx >> 8) & 0xFF;
+                                if (type == CPUID_EXTENDED_TOPOLOGY_LEVEL_TYPE_INVALID) {
+                                        break;
+                                }
+                                if (type == CPUID_EXTENDED_TOPOLOGY_LEVEL_TYPE_SMT) {
+                                        topology->smt_shift = eax & 0x1F;
+                                }
+                                else if (type == CPUID_EXTENDED_TOPOLOGY_LEVEL_TYPE_CORE) {
+                                        topology->package_shift = eax & 0x1F;
+                                }
+                        }
+                        if (topology->package_shift < topology->smt_shift) {
+                                topology->package_shift = topology->smt_shift;
+                        }
+                }
+        }
+        if (!extended_topology) {
+                uint32_t cores_per_package = 1;
+                if (max_leaf >= CPUID_LEAF_DETERMINISTIC_CACHE_PARAMETERS) {
+                        __cpuid_count(CPUID_LEAF_DETERMINISTIC_CACHE_PARAMETERS, 0, eax, ebx, ecx, edx);
+                        if ((eax & 0x1F) != CPUID_CACHE_TYPE_NULL) {
+                                cores_per_package = (eax >> 26) + 1;
+                        }
+                }
+                if (logical_per_package < cores_per_package) {
+                        logical_per_package = cores_per_package;
+                }
+                topology->smt_shift = count_to_shift(logical_per_package / cores_per_package);
+                topology->package_shift = count_to_shift(logical_per_package);
+        }
+
+        // Leaf 4 also reports how many logical processors share each cache level.
+
+        for (size_t i = 0; i < TOPOLOGY_CACHE_LEVELS; i++) {
+                topology->cache_shift[i] = TOPOLOGY_CACHE_UNKNOWN;
+        }
+        if (max_leaf >= CPUID_LEAF_DETERMINISTIC_CACHE_PARAMETERS) {
+                for (uint32_t index = 0; ; index++) {
+                        __cpuid_count(CPUID_LEAF_DETERMINISTIC_CACHE_PARAMETERS, index, eax, ebx, ecx, edx);
+                        if ((eax & 0x1F) == CPUID_CACHE_TYPE_NULL) {
+                                break;
+                        }
+                        uint8_t level = (eax >> 5) & 0x7;
+                        if (level >= 1 && level <= TOPOLOGY_CACHE_LEVELS) {
+                                topology->cache_shift[level - 1] = count_to_shift(((eax >> 14) & 0xFFF) + 1);
+                        }
+                }
+        }
+        topology->thread_id = topology->apic_id & ((1U << topology->smt_shift) - 1);
+        topology->core_id = (topology->apic_id & ((1U << topology->package_shift) - 1)) >> topology->smt_shift;
+        topology->package_id = topology->apic_id >> topology->package_shift;
+}
+
+static bool same_domain(cpu_topology_t *a, cpu_topology_t *b, uint8_t shift) {
+        return shift != TOPOLOGY_CACHE_UNKNOWN && (a->apic_id >> shift) == (b->apic_id >> shift);
+}
+
+/*
+ * Builds the sibling masks of every cpu. Must be called once every cpu ran topology_init(). Cpus that never came online
+ * have a zeroed topology (local apic id 0) and are nobody's sibling.
+ */
+
+void topology_build_masks() {
+        for (size_t i = 0; i < num_cpus; i++) {
+                cpu_topology_t *topology = &cpu_data[i].topology;
+                for (size_t j = 0; j < num_cpus; j++) {
+                        if (j != i && !cpumask_test(&cpu_online_mask, j)) {
+                                continue;
+                        }
+                        cpu_topology_t *other = &cpu_data[j].topology;
+                        if (j == i || same_domain(topology, other, topology->smt_shift)) {
+                                cpumask_set(&topology->smt_siblings, j);
+                        }
+                        if (j == i || same_domain(topology, other, topology->package_shift)) {
+                                cpumask_set(&topology->package_siblings, j);
+                        }
+                        if (j == i || same_domain(topology, other, topology->cache_shift[1])) {
+                                cpumask_set(&topology->l2_siblings, j);
+                        }
+                        if (j == i || same_domain(topology, other, topology->cache_shift[2])) {
+                                cpumask_set(&topology->l3_siblings, j);
+                        }
+                }
+        }
+        printk("[KERNEL]: CPU topology: %d packages, %d threads per core.\n", topology_num_packages(), cpumask_weight(&cpu_data[0].topology.smt_siblings));
+}
+
+/*
+ * Query interface. Cpus are identified by their index in the cpu_data array.
+ */
+
+const cpu_topology_t* topology_get(size_t cpu) {
+        return &cpu_data[cpu].topology;
+}
+
+const cpumask_t* topology_smt_siblings(size_t cpu) {
+        return &cpu_data[cpu].topology.smt_siblings;
+}
+
+const cpumask_t* topology_package_siblings(size_t cpu) {
+        return &cpu_data[cpu].topology.package_siblings;
+}
+
+/*
+ * Returns the cpus sharing the cache of the given level (2 or 3) with cpu or NULL for other levels.
+ */
+
+const cpumask_t* topology_cache_siblings(size_t cpu, uint8_t level) {
+        switch (level) {
+                case 2:
+                        return &cpu_data[cpu].topology.l2_siblings;
+                case 3:
+                        return &cpu_data[cpu].topology.l3_siblings;
+                default:
+                        return NULL;
+        }
+}
+
+bool topology_share_cache(size_t a, size_t b, uint8_t level) {
+        const cpumask_t *siblings = topology_cache_siblings(a, level);
+        return siblings != NULL && cpumask_test(siblings, b);
+}
+
+/*
+ * A package is counted once through its lowest indexed cpu.
+ */
+
+size_t topology_num_packages() {
+        size_t packages = 0;
+        for (size_t i = 0; i < num_cpus; i++) {
+                if (!cpumask_test(&cpu_online_mask, i)) {
+                        continue;
+                }
+                bool first = true;
+                for (size_t j = 0; j < i; j++) {
+                        if (cpumask_test(&cpu_data[i].topology.package_siblings, j)) {
+                                first = false;
+                                break;
+                        }
+                }
+                if (first) {
+                        packages++;
+                }
+        }
+        return packages;
+}
\ No newline at end of file
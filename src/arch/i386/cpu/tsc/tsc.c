@@ -0,0 +1,54 @@
+#include <cpuid.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <arch/cpu/cpu.h>
+#include <arch/cpu/topology.h>
+#include <arch/cpu/tsc.h>
+#include <kernel/clocksource.h>
+
+/*
+ * TSC cycles per second. It is measured once by the BSP: every cpu is assumed to have the same TSC frequency and
+ * TSCs started together.
+ */
+
+uint64_t tsc_frequency = 0;
+
+static uint64_t tsc_read(clocksource_t *clocksource) {
+        (void) clocksource;
+        return read_tsc();
+}
+
+static clocksource_t tsc_clocksource = {
+        name: "tsc",
+        rating: TSC_CLOCKSOURCE_RATING,
+        max_idle_ns: 0,
+        read: tsc_read,
+};
+
+/*
+ * Measures the TSC frequency against the clocksource in use (PIT channel 2 at boot) with interrupts disabled and registers
+ * the TSC as clocksource. Returns -1 if the processor has no TSC or it does not count.
+ */
+
+int tsc_init() {
+        unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+        __get_cpuid(CPUID_LEAF_FEATURES, &eax, &ebx, &ecx, &edx);
+        if (!(edx & CPUID_FEATURES_EDX_TSC)) {
+                return -1;
+        }
+        uint32_t eflags = arch_irq_save();
+        uint64_t start = ktime_get_ns();
+        uint64_t tsc_start = read_tsc();
+        uint64_t end;
+        while ((end = ktime_get_ns()) - start < TSC_CALIBRATION_MS * NSEC_PER_MSEC) {
+                arch_pause();
+        }
+        uint64_t tsc_end = read_tsc();
+        arch_irq_restore(eflags);
+        if (tsc_end <= tsc_start) {
+                return -1;
+        }
+        tsc_frequency = ((tsc_end - tsc_start) * NSEC_PER_SEC) / (end - start);
+        tsc_clocksource.frequency = tsc_frequency;
+        return clocksource_register(&tsc_clocksource);
+}
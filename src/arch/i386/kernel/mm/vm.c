@@ -2,13 +2,35 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <arch/paging.h>
+#include <arch/cpu/cpu.h>
+#include <arch/cpu/percpu.h>
+#include <arch/cpu/smp.h>
+#include <arch/cpu/smp_call.h>
 #include <arch/kernel/mm/vm.h>
 #include <arch/mmu.h>
 #include <arch/types.h>
 #include <kernel/assert.h>
 #include <kernel/mm/pm.h>
+#include <kernel/printk.h>
+#include <kernel/spinlock.h>
+#include <lib/bitmap.h>
+#include <lib/string.h>
 
-/* 
+address_space_t kernel_address_space;
+
+/*
+ * Tracks the used slots of the kernel window. Slots are handed out to page directories of
+ * address spaces, the last num_cpus slots are reserved as per cpu scratch slots by vm_init().
+ */
+
+static uint32_t window_bitmap[VM_WINDOW_SLOTS / 32];
+static DEFINE_PER_CPU(pt_cache_t, pt_cache);
+spinlock_t vm_lock = {
+        name: "vm",
+        lock: 0,
+};
+
+/*
  * This routine gets the virtual address of the page table containing the mapping for a virtual address.
  * It works by using the well known recursive directory trick. The last entry of the kernel directory (entry 1023)
  * is mapped to the physical address of the kernel_directory itself. This implies that the virtual address space from
@@ -16,44 +38,202 @@
  */
 
 inline static virt_addr_t get_table_virtual_address(virt_addr_t addr) {
-        
+
         // First get the directory index from the virtual address.
-    
+
         size_t dir_entry_index = addr >> 22 & 0x3FF;
-    
+
         // Add the directory index multiplied by the size of a page to the base address of the recursive directory address space.
-    
+
         return (virt_addr_t) RECURSIVE_DIRECTORY_START_REGION + (dir_entry_index * PAGE_SIZE);
 }
 
+/*
+ * The window page table is shared by every address space so it is always reachable through the recursive mapping.
+ */
+
+static void window_map(size_t slot, phys_addr_t phys) {
+        page_table_t *window = (page_table_t*) get_table_virtual_address(VM_WINDOW_START);
+        window->entry[slot].address = phys >> 12;
+        window->entry[slot].read_write = 1;
+        window->entry[slot].user_supervisor = 0;
+        window->entry[slot].present = 1;
+        flush_tlb_single(VM_WINDOW_SLOT_ADDRESS(slot));
+}
+
+static void window_unmap(size_t slot) {
+        page_table_t *window = (page_table_t*) get_table_virtual_address(VM_WINDOW_START);
+        window->entry[slot].present = 0;
+        window->entry[slot].address = 0;
+        flush_tlb_single(VM_WINDOW_SLOT_ADDRESS(slot));
+}
+
+static void window_flush_slot(void *slot_address) {
+        flush_tlb_single((virt_addr_t) slot_address);
+}
+
+/*
+ * Unmaps a directory slot on every cpu: any cpu that touched the directory through the window can still cache the
+ * translation, which must be gone before the slot is handed out again. Must be called with interrupts enabled.
+ */
+
+static void window_unmap_shared(size_t slot) {
+        window_unmap(slot);
+        smp_call_function(&cpu_online_mask, window_flush_slot, (void*) VM_WINDOW_SLOT_ADDRESS(slot), true);
+}
+
+static inline size_t scratch_slot(void) {
+        return VM_WINDOW_SLOTS - 1 - this_cpu_read(cpu_index);
+}
+
+/*
+ * Preallocates every page table of the kernel half of kernel_directory (except the recursive entry) so that
+ * map_page() never has to create kernel directory entries after this point. This makes kernel_directory a
+ * template whose kernel half can be copied by reference into every new address space without ever having
+ * to keep copies coherent. Must be called after the physical memory manager is initialized.
+ */
+
+void vm_init() {
+        size_t allocated = 0;
+        for (size_t i = KERNEL_DIRECTORY_FIRST_ENTRY; i < RECURSIVE_DIRECTORY_ENTRY; i++) {
+                if (kernel_directory.entry[i].present) {
+                        continue;
+                }
+                phys_addr_t frame = get_free_frame();
+                if (frame == (phys_addr_t) -1) {
+                        panic("[KERNEL]: Failed to allocate memory! File: %s line: %d function: %s\n", __FILENAME__, __LINE__, __func__);
+                }
+                kernel_directory.entry[i].address = frame >> 12;
+                kernel_directory.entry[i].read_write = 1;
+                kernel_directory.entry[i].user_supervisor = 0;
+                kernel_directory.entry[i].present = 1;
+
+                // The new table is reachable through the recursive mapping, zero it there.
+
+                virt_addr_t table = RECURSIVE_DIRECTORY_START_REGION + (i * PAGE_SIZE);
+                flush_tlb_single(table);
+                memset((void*) table, 0x0, PAGE_SIZE);
+                allocated++;
+        }
+
+        // Reserve the per cpu scratch slots at the end of the window.
+
+        for (size_t i = 0; i < num_cpus; i++) {
+                bitmap_set(window_bitmap, VM_WINDOW_SLOTS - 1 - i);
+        }
+        kernel_address_space.directory = &kernel_directory;
+        kernel_address_space.directory_physical = VIRTUAL_TO_PHYSICAL(&kernel_directory);
+        kernel_address_space.window_slot = (size_t) -1;
+        printk("[KERNEL]: Preallocated %d kernel page tables.\n", allocated);
+}
+
+/*
+ * Maps and unmaps a physical frame in the scratch slot of the calling cpu and returns its virtual address.
+ * The caller must not be migrated or interrupted by other scratch users while the mapping is in use.
+ */
+
+void* vm_map_scratch(phys_addr_t phys) {
+        size_t slot = scratch_slot();
+        window_map(slot, phys);
+        return (void*) VM_WINDOW_SLOT_ADDRESS(slot);
+}
+
+void vm_unmap_scratch() {
+        window_unmap(scratch_slot());
+}
+
+/*
+ * Refills an empty page table stock: first from the deferred free list (whose frames are already zeroed) and
+ * otherwise with a batch of frames from the physical memory manager, zeroed through the scratch slot.
+ * Must be called with interrupts disabled. Returns 0 on success or -1 in case of failure.
+ */
+
+static int pt_cache_refill(pt_cache_t *cache) {
+        if (cache->deferred_count) {
+                memcpy(cache->stock, cache->deferred, sizeof(phys_addr_t) * cache->deferred_count);
+                cache->stock_count = cache->deferred_count;
+                cache->deferred_count = 0;
+                return 0;
+        }
+        size_t count = get_free_frames(cache->stock, PT_CACHE_BATCH);
+        for (size_t i = 0; i < count; i++) {
+                memset(vm_map_scratch(cache->stock[i]), 0x0, PAGE_SIZE);
+        }
+        vm_unmap_scratch();
+        cache->stock_count = count;
+        return count ? 0 : -1;
+}
+
+/*
+ * Returns a zeroed frame for a new page table or -1 in case of failure.
+ */
+
+static phys_addr_t pt_cache_alloc() {
+        phys_addr_t frame = (phys_addr_t) -1;
+        uint32_t eflags = arch_irq_save();
+        pt_cache_t *cache = this_cpu_ptr(pt_cache);
+        if (cache->stock_count || !pt_cache_refill(cache)) {
+                frame = cache->stock[--cache->stock_count];
+        }
+        arch_irq_restore(eflags);
+        return frame;
+}
+
+/*
+ * Gives back a page table frame. The caller must have zeroed it already.
+ */
+
+static void pt_cache_free(phys_addr_t frame) {
+        uint32_t eflags = arch_irq_save();
+        pt_cache_t *cache = this_cpu_ptr(pt_cache);
+        if (cache->stock_count < PT_CACHE_STOCK_SIZE) {
+                cache->stock[cache->stock_count++] = frame;
+        }
+        else {
+                cache->deferred[cache->deferred_count++] = frame;
+                if (cache->deferred_count == PT_CACHE_BATCH) {
+                        free_frames(cache->deferred, cache->deferred_count);
+                        cache->deferred_count = 0;
+                }
+        }
+        arch_irq_restore(eflags);
+}
+
+/*
+ * map_page() and unmap_page() work on the current address space through the recursive directory entry.
+ * Since the kernel half is preallocated, directory entries are only ever created for the user half here.
+ */
+
 int map_page(phys_addr_t phys, virt_addr_t virt, uint16_t flags, bool kmalloc_init) {
+        page_directory_t *directory = (page_directory_t*) RECURSIVE_DIRECTORY_ADDRESS;
         bool dir_created = false;
         size_t dir_idx = virt >> 22 & 0x3FF;
         size_t tbl_idx = virt >> 12 & 0x3FF;
 
         // If this page table does not exist, create it.
-        
-        if (!kernel_directory.entry[dir_idx].present) {
-                
-                // Allocate a new frame for the new page table.
-                
-                phys_addr_t frame = get_free_frame();
+
+        if (!directory->entry[dir_idx].present) {
+
+                // Take an already zeroed frame for the new page table from the page table cache.
+
+                phys_addr_t frame = pt_cache_alloc();
                 if (frame == (phys_addr_t) -1) {
                         return -1;
                 }
-                kernel_directory.entry[dir_idx].address = frame >> 12;
-                kernel_directory.entry[dir_idx].present = flags & 0x1;
-                kernel_directory.entry[dir_idx].read_write = flags >> 1 & 0x1;
-                kernel_directory.entry[dir_idx].user_supervisor = flags >> 2 & 0x1;
-                kernel_directory.entry[dir_idx].page_write_through = flags >> 3 & 0x1;
-                kernel_directory.entry[dir_idx].page_cache_disable = flags >> 4 & 0x1;
+                directory->entry[dir_idx].address = frame >> 12;
+                directory->entry[dir_idx].present = flags & 0x1;
+                directory->entry[dir_idx].read_write = flags >> 1 & 0x1;
+                directory->entry[dir_idx].user_supervisor = flags >> 2 & 0x1;
+                directory->entry[dir_idx].page_write_through = flags >> 3 & 0x1;
+                directory->entry[dir_idx].page_cache_disable = flags >> 4 & 0x1;
+                flush_tlb_single(get_table_virtual_address(virt));
                 dir_created = true;
         }
-        
+
         // Get the address of the page table virt refers to.
-        
+
         page_table_t *table = (page_table_t*) get_table_virtual_address(virt);
-        
+
         /*
         * Check that we are not trying to map a page to an address that has already a mapping.
         * If a directory was created it means that there were no mappings for this address.
@@ -76,6 +256,7 @@ int map_page(phys_addr_t phys, virt_addr_t virt, uint16_t flags, bool kmalloc_in
 }
 
 int unmap_page(virt_addr_t address) {
+        page_directory_t *directory = (page_directory_t*) RECURSIVE_DIRECTORY_ADDRESS;
         bool unmap_directory = true;
         size_t dir_idx = address >> 22 & 0x3FF;
         size_t tbl_idx = address >> 12 & 0x3FF;
@@ -86,9 +267,16 @@ int unmap_page(virt_addr_t address) {
         table->entry[tbl_idx].present = 0;
         free_frame(table->entry[tbl_idx].address << 12);
         table->entry[tbl_idx].address = 0;
-        
+        flush_tlb_single(address);
+
+        // Kernel page tables are shared by every address space and are never freed.
+
+        if (dir_idx >= KERNEL_DIRECTORY_FIRST_ENTRY) {
+                return 0;
+        }
+
         // Scan the entire directory to see if we can free it.
-        
+
         for (size_t i = 0; i < 1024; i++) {
                 if (table->entry[i].present) {
                         unmap_directory = false;
@@ -96,17 +284,100 @@ int unmap_page(virt_addr_t address) {
                 }
         }
         if (unmap_directory) {
-                if (kernel_directory.entry[dir_idx].present == 0) {
+                if (directory->entry[dir_idx].present == 0) {
                         return -1;
                 }
-                kernel_directory.entry[dir_idx].present = 0;
-                free_frame(kernel_directory.entry[dir_idx].address << 12);
-                kernel_directory.entry[dir_idx].address = 0;
+
+                // Zero the table while it is still reachable through the recursive mapping and hand it back to the cache.
+
+                phys_addr_t table_frame = directory->entry[dir_idx].address << 12;
+                memset(table, 0x0, PAGE_SIZE);
+                directory->entry[dir_idx].present = 0;
+                directory->entry[dir_idx].address = 0;
+                flush_tlb_single((virt_addr_t) table);
+                pt_cache_free(table_frame);
         }
-        flush_tlb_single(address);
         return 0;
 }
 
+/*
+ * Creates a new address space: the user half starts empty and the kernel half references the preallocated
+ * kernel page tables of kernel_directory. The cost is one zeroed page plus a copy of 256 directory entries.
+ * The new directory stays mapped in the kernel window for as long as the address space exists.
+ * Returns 0 on success or -1 in case of failure.
+ */
+
+int create_address_space(address_space_t *address_space) {
+        lock(&vm_lock);
+        int slot = bitmap_first_unset(window_bitmap, VM_WINDOW_SLOTS);
+        if (slot == -1) {
+                unlock(&vm_lock);
+                return -1;
+        }
+        bitmap_set(window_bitmap, slot);
+        unlock(&vm_lock);
+        phys_addr_t frame = get_free_frame();
+        if (frame == (phys_addr_t) -1) {
+                lock(&vm_lock);
+                bitmap_unset(window_bitmap, slot);
+                unlock(&vm_lock);
+                return -1;
+        }
+        window_map(slot, frame);
+        page_directory_t *directory = (page_directory_t*) VM_WINDOW_SLOT_ADDRESS(slot);
+        memset(directory, 0x0, sizeof(page_directory_entry_t) * KERNEL_DIRECTORY_FIRST_ENTRY);
+        memcpy(&directory->entry[KERNEL_DIRECTORY_FIRST_ENTRY], &kernel_directory.entry[KERNEL_DIRECTORY_FIRST_ENTRY], sizeof(page_directory_entry_t) * KERNEL_DIRECTORY_ENTRIES);
+
+        // The recursive entry must point to the new directory itself.
+
+        directory->entry[RECURSIVE_DIRECTORY_ENTRY].address = frame >> 12;
+        address_space->directory = directory;
+        address_space->directory_physical = frame;
+        address_space->window_slot = slot;
+        return 0;
+}
+
+/*
+ * Frees every user page table of an address space along with the frames they map, then the directory itself.
+ * The kernel half is shared and left untouched. The address space must not be the current one on any cpu.
+ * Must be called with interrupts enabled since the directory slot is flushed from the TLB of every cpu.
+ */
+
+void destroy_address_space(address_space_t *address_space) {
+        assert(address_space->directory_physical != kernel_address_space.directory_physical);
+        assert(address_space->directory_physical != read_cr3());
+        page_directory_t *directory = address_space->directory;
+        for (size_t i = 0; i < KERNEL_DIRECTORY_FIRST_ENTRY; i++) {
+                if (!directory->entry[i].present) {
+                        continue;
+                }
+                phys_addr_t table_frame = directory->entry[i].address << 12;
+                uint32_t eflags = arch_irq_save();
+                page_table_t *table = (page_table_t*) vm_map_scratch(table_frame);
+                for (size_t j = 0; j < 1024; j++) {
+                        if (table->entry[j].present) {
+                                free_frame(table->entry[j].address << 12);
+                        }
+                }
+                memset(table, 0x0, PAGE_SIZE);
+                vm_unmap_scratch();
+                arch_irq_restore(eflags);
+                pt_cache_free(table_frame);
+                directory->entry[i].present = 0;
+        }
+        window_unmap_shared(address_space->window_slot);
+        free_frame(address_space->directory_physical);
+        lock(&vm_lock);
+        bitmap_unset(window_bitmap, address_space->window_slot);
+        unlock(&vm_lock);
+        address_space->directory = NULL;
+        address_space->directory_physical = 0;
+}
+
+void switch_address_space(address_space_t *address_space) {
+        write_cr3(address_space->directory_physical);
+}
+
 void do_page_fault(virt_addr_t fault_address) {
         panic("Page fault at address: %x\n", fault_address);
 }
\ No newline at end of file
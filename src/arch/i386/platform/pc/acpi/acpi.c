@@ -0,0 +1,258 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <arch/align.h>
+#include <arch/cpu/smp.h>
+#include <arch/kernel/mm/vm.h>
+#include <arch/mmu.h>
+#include <arch/paging.h>
+#include <arch/types.h>
+#include <kernel/printk.h>
+#include <lib/string.h>
+#include <platform/acpi.h>
+#include <platform/multiboot2.h>
+
+bool acpi = false;
+phys_addr_t acpi_local_apic_address = 0;
+bool acpi_pcat_compat = false;
+size_t acpi_num_local_apics = 0;
+uint8_t acpi_local_apic_ids[ACPI_MAX_LOCAL_APICS];
+size_t acpi_num_io_apics = 0;
+acpi_io_apic_t acpi_io_apics[ACPI_MAX_IO_APICS];
+size_t acpi_num_interrupt_source_overrides = 0;
+acpi_interrupt_source_override_t acpi_interrupt_source_overrides[ACPI_MAX_INTERRUPT_SOURCE_OVERRIDES];
+
+/*
+ * Page table backing the ACPI window (see acpi.h) and the next free page in it.
+ * Mappings are never removed as the tables are only parsed once during boot.
+ */
+
+static __attribute__((__aligned__(PAGE_SIZE))) page_table_t acpi_page_table;
+static size_t acpi_window_next = 0;
+
+static uint8_t checksum(void* addr, size_t len) {
+        uint8_t checksum = 0;
+        uint8_t *p = (uint8_t*) addr;
+        for (size_t i = 0; i < len; i++) {
+                checksum += p[i];
+        }
+        return checksum;
+}
+
+/*
+ * Maps length bytes of physical memory starting at phys read only in the ACPI window.
+ * Returns the virtual address of phys or NULL if the window is full.
+ */
+
+static void* acpi_map(phys_addr_t phys, size_t length) {
+        phys_addr_t first = PAGE_ROUND_DOWN(phys);
+        size_t pages = (PAGE_ROUND_UP(phys + length) - first) / PAGE_SIZE;
+        if (acpi_window_next + pages > ACPI_WINDOW_PAGES) {
+                return NULL;
+        }
+        virt_addr_t virt = ACPI_WINDOW_START + (acpi_window_next * PAGE_SIZE);
+        for (size_t i = 0; i < pages; i++) {
+                page_table_entry_t *entry = &acpi_page_table.entry[acpi_window_next++];
+                entry->address = (first >> 12) + i;
+                entry->read_write = 0;
+                entry->user_supervisor = 0;
+                entry->present = 1;
+                flush_tlb_single(virt + (i * PAGE_SIZE));
+        }
+        return (void*) (virt + (phys - first));
+}
+
+/*
+ * Maps a whole system description table and validates its signature and checksum.
+ * Returns NULL if the table is not valid.
+ */
+
+static acpi_sdt_header_t* acpi_map_table(phys_addr_t phys, const char *signature) {
+        acpi_sdt_header_t *header = (acpi_sdt_header_t*) acpi_map(phys, sizeof(acpi_sdt_header_t));
+        if (header == NULL) {
+                return NULL;
+        }
+        if (signature != NULL && memcmp(header->signature, signature, ACPI_SDT_SIGNATURE_SIZE) != 0) {
+                return NULL;
+        }
+        header = (acpi_sdt_header_t*) acpi_map(phys, header->length);
+        if (header == NULL || checksum((void*) header, header->length) != 0) {
+                return NULL;
+        }
+        return header;
+}
+
+static bool rsdp_valid(acpi_rsdp_t *rsdp) {
+        if (memcmp(rsdp->signature, ACPI_RSDP_SIGNATURE, ACPI_RSDP_SIGNATURE_SIZE) != 0 || checksum((void*) rsdp, ACPI_RSDP_REVISION_1_SIZE) != 0) {
+                return false;
+        }
+        if (rsdp->revision >= ACPI_RSDP_REVISION_2 && checksum((void*) rsdp, rsdp->length) != 0) {
+                return false;
+        }
+        return true;
+}
+
+static acpi_rsdp_t* rsdp_search(void *addr, size_t length) {
+        uint8_t *end_address = (uint8_t*) addr + length;
+        for (uint8_t *p = (uint8_t*) ALIGN(addr, 16); p < end_address; p += 16) {
+                if (rsdp_valid((acpi_rsdp_t*) p)) {
+                        return (acpi_rsdp_t*) p;
+                }
+        }
+        return NULL;
+}
+
+/*
+ * The RSDP is looked for in the multiboot2 tags first (the ACPI 2.0+ one is preferred) and then at the
+ * locations specified by the ACPI specification for legacy BIOS systems.
+ */
+
+static acpi_rsdp_t* rsdp_find(multiboot2_information_header_t *m_boot2_info) {
+        acpi_rsdp_t *old_rsdp = NULL;
+        multiboot2_tag_header_t *tag;
+        for (tag = (multiboot2_tag_header_t*) ((uintptr_t) (m_boot2_info) + 8); tag->type != MULTIBOOT2_TAG_END_TYPE;) {
+                if (tag->type == MULTIBOOT2_TAG_ACPI_NEW_RSDP_TYPE) {
+                        acpi_rsdp_t *rsdp = (acpi_rsdp_t*) ((multiboot2_tag_acpi_new_rsdp_t*) tag)->rsdp;
+                        if (rsdp_valid(rsdp)) {
+                                return rsdp;
+                        }
+                }
+                else if (tag->type == MULTIBOOT2_TAG_ACPI_OLD_RSDP_TYPE) {
+                        acpi_rsdp_t *rsdp = (acpi_rsdp_t*) ((multiboot2_tag_acpi_old_rsdp_t*) tag)->rsdp;
+                        if (rsdp_valid(rsdp)) {
+                                old_rsdp = rsdp;
+                        }
+                }
+
+                // Multiboot2 tags are 8 byte aligned. See multiboo2.h for more info.
+
+                tag = ALIGN((multiboot2_tag_header_t*) ((uintptr_t) (tag) + tag->size), 8);
+        }
+        if (old_rsdp != NULL) {
+                return old_rsdp;
+        }
+        virt_addr_t ebda_address = PHYSICAL_TO_VIRTUAL(*(uint16_t*) PHYSICAL_TO_VIRTUAL(BDA_EBDA_BASE_ADDRESS) << BDA_EBDA_BASE_ADDRESS_LEFT_SHIFT);
+        acpi_rsdp_t *rsdp = rsdp_search((void*) ebda_address, ACPI_RSDP_EBDA_SEARCH_SIZE);
+        if (rsdp == NULL) {
+                rsdp = rsdp_search((void*) PHYSICAL_TO_VIRTUAL(BIOS_ROM_STARTING_ADDRESS), BIOS_ROM_ENDING_ADDRESS - BIOS_ROM_STARTING_ADDRESS);
+        }
+        return rsdp;
+}
+
+/*
+ * Walks the RSDT or the XSDT looking for a table with the given signature.
+ * XSDT entries above 4Gb cannot be mapped on this architecture and are skipped.
+ */
+
+static acpi_sdt_header_t* acpi_find_table(acpi_rsdp_t *rsdp, const char *signature) {
+        acpi_sdt_header_t *root = NULL;
+        bool xsdt = false;
+        if (rsdp->revision >= ACPI_RSDP_REVISION_2 && rsdp->xsdt_address && rsdp->xsdt_address <= UINT32_MAX) {
+                root = acpi_map_table((phys_addr_t) rsdp->xsdt_address, ACPI_XSDT_SIGNATURE);
+                xsdt = root != NULL;
+        }
+        if (root == NULL) {
+                root = acpi_map_table(rsdp->rsdt_address, ACPI_RSDT_SIGNATURE);
+        }
+        if (root == NULL) {
+                return NULL;
+        }
+        size_t entry_size = xsdt ? sizeof(uint64_t) : sizeof(uint32_t);
+        size_t num_entries = (root->length - sizeof(acpi_sdt_header_t)) / entry_size;
+        uint8_t *entries = (uint8_t*) (root + 1);
+        for (size_t i = 0; i < num_entries; i++) {
+                uint64_t address = xsdt ? *(uint64_t*) (entries + i * entry_size) : *(uint32_t*) (entries + i * entry_size);
+                if (address > UINT32_MAX) {
+                        continue;
+                }
+                acpi_sdt_header_t *header = (acpi_sdt_header_t*) acpi_map((phys_addr_t) address, sizeof(acpi_sdt_header_t));
+                if (header != NULL && memcmp(header->signature, signature, ACPI_SDT_SIGNATURE_SIZE) == 0) {
+                        return acpi_map_table((phys_addr_t) address, signature);
+                }
+        }
+        return NULL;
+}
+
+static void parse_madt(acpi_madt_t *madt) {
+        acpi_local_apic_address = madt->local_apic_address;
+        acpi_pcat_compat = madt->flags & ACPI_MADT_FLAGS_PCAT_COMPAT;
+        uint8_t *entry = (uint8_t*) (madt + 1);
+        uint8_t *end = (uint8_t*) madt + madt->header.length;
+        while (entry + sizeof(acpi_madt_entry_header_t) <= end) {
+                acpi_madt_entry_header_t *header = (acpi_madt_entry_header_t*) entry;
+                if (header->length < sizeof(acpi_madt_entry_header_t)) {
+                        break;
+                }
+                switch (header->type) {
+                        case ACPI_MADT_ENTRY_LOCAL_APIC:
+                                acpi_madt_local_apic_entry_t *local_apic = (acpi_madt_local_apic_entry_t*) entry;
+                                if ((local_apic->flags & ACPI_MADT_LOCAL_APIC_FLAGS_ENABLED) && acpi_num_local_apics < ACPI_MAX_LOCAL_APICS) {
+                                        acpi_local_apic_ids[acpi_num_local_apics++] = local_apic->local_apic_id;
+                                }
+                                break;
+                        case ACPI_MADT_ENTRY_IO_APIC:
+                                acpi_madt_io_apic_entry_t *io_apic = (acpi_madt_io_apic_entry_t*) entry;
+                                if (acpi_num_io_apics < ACPI_MAX_IO_APICS) {
+                                        acpi_io_apics[acpi_num_io_apics].id = io_apic->io_apic_id;
+                                        acpi_io_apics[acpi_num_io_apics].address = io_apic->io_apic_address;
+                                        acpi_io_apics[acpi_num_io_apics].global_system_interrupt_base = io_apic->global_system_interrupt_base;
+                                        acpi_num_io_apics++;
+                                }
+                                break;
+                        case ACPI_MADT_ENTRY_INTERRUPT_SOURCE_OVERRIDE:
+                                acpi_madt_interrupt_source_override_entry_t *override = (acpi_madt_interrupt_source_override_entry_t*) entry;
+                                if (acpi_num_interrupt_source_overrides < ACPI_MAX_INTERRUPT_SOURCE_OVERRIDES) {
+                                        acpi_interrupt_source_overrides[acpi_num_interrupt_source_overrides].source = override->source;
+                                        acpi_interrupt_source_overrides[acpi_num_interrupt_source_overrides].global_system_interrupt = override->global_system_interrupt;
+                                        acpi_interrupt_source_overrides[acpi_num_interrupt_source_overrides].flags = override->flags;
+                                        acpi_num_interrupt_source_overrides++;
+                                }
+                                break;
+                        case ACPI_MADT_ENTRY_LOCAL_APIC_ADDRESS_OVERRIDE:
+                                acpi_madt_local_apic_address_override_entry_t *address_override = (acpi_madt_local_apic_address_override_entry_t*) entry;
+                                if (address_override->local_apic_address <= UINT32_MAX) {
+                                        acpi_local_apic_address = (phys_addr_t) address_override->local_apic_address;
+                                }
+                                break;
+                }
+                entry += header->length;
+        }
+}
+
+/*
+ * Locates the RSDP and parses the MADT. Must be called before smp_init() which prefers the MADT over the MP tables.
+ * Returns 0 on success or -1 if no valid MADT was found.
+ */
+
+int acpi_init(multiboot2_information_header_t *m_boot2_info) {
+
+        // Install the ACPI window page table in the kernel half, so it is shared by every address space.
+
+        kernel_directory.entry[ACPI_WINDOW_ENTRY].address = VIRTUAL_TO_PHYSICAL(&acpi_page_table) >> 12;
+        kernel_directory.entry[ACPI_WINDOW_ENTRY].read_write = 1;
+        kernel_directory.entry[ACPI_WINDOW_ENTRY].user_supervisor = 0;
+        kernel_directory.entry[ACPI_WINDOW_ENTRY].present = 1;
+        acpi_rsdp_t *rsdp = rsdp_find(m_boot2_info);
+        if (rsdp == NULL) {
+                return -1;
+        }
+        acpi_madt_t *madt = (acpi_madt_t*) acpi_find_table(rsdp, ACPI_MADT_SIGNATURE);
+        if (madt == NULL) {
+                return -1;
+        }
+        parse_madt(madt);
+        if (acpi_num_local_apics == 0) {
+                return -1;
+        }
+        acpi = true;
+        printk("[KERNEL]: ACPI MADT: %d local apics, %d io apics, %d interrupt source overrides.\n", acpi_num_local_apics, acpi_num_io_apics, acpi_num_interrupt_source_overrides);
+        #ifdef DEBUG
+                for (size_t i = 0; i < acpi_num_io_apics; i++) {
+                        printk("I/O Apic id: %x address: %x global system interrupt base: %x\n", acpi_io_apics[i].id, acpi_io_apics[i].address, acpi_io_apics[i].global_system_interrupt_base);
+                }
+                for (size_t i = 0; i < acpi_num_interrupt_source_overrides; i++) {
+                        printk("Interrupt source override: IRQ %x -> GSI %x flags: %x\n", acpi_interrupt_source_overrides[i].source, acpi_interrupt_source_overrides[i].global_system_interrupt, acpi_interrupt_source_overrides[i].flags);
+                }
+        #endif
+        return 0;
+}
\ No newline at end of file
@@ -1,5 +1,8 @@
+#include <stdbool.h>
 #include <stdint.h>
 #include <arch/cpu/io.h>
+#include <kernel/clocksource.h>
+#include <kernel/spinlock.h>
 #include <platform/pit.h>
 
 void pit_interrupt_on_terminal_count(uint16_t count) {
@@ -36,4 +39,59 @@ uint16_t pit_get_counter_value(uint8_t channel) {
                 default:
                         return counter_value;            
         }
-}
\ No newline at end of file
+}
+
+/*
+ * Channel 2 counts down from 65536 over and over with the speaker disconnected, about every 55 ms. It is extended to
+ * 64 bits by accumulating the counts elapsed since the previous read, so it must be read at least once per period:
+ * max_idle_ns keeps idle cpus from sleeping longer than half of it while it is the clocksource.
+ */
+
+static spinlock_t pit_lock = {
+        name: "pit",
+        lock: 0,
+};
+
+static uint16_t pit_last_count = 0;
+static uint64_t pit_cycles = 0;
+
+static uint64_t pit_read(clocksource_t *clocksource) {
+        (void) clocksource;
+        uint32_t eflags = lock_irqsave(&pit_lock);
+        uint16_t count = pit_get_counter_value(2);
+        pit_cycles += (uint16_t) (pit_last_count - count);
+        pit_last_count = count;
+        uint64_t cycles = pit_cycles;
+        unlock_irqrestore(&pit_lock, eflags);
+        return cycles;
+}
+
+static clocksource_t pit_clocksource = {
+        name: "pit",
+        rating: PIT_CLOCKSOURCE_RATING,
+        frequency: PIT_FREQUENCY,
+        max_idle_ns: (0x10000 * NSEC_PER_SEC) / (2 * PIT_FREQUENCY),
+        read: pit_read,
+};
+
+/*
+ * Starts channel 2 and registers it as clocksource. Must be called once, it is the boot clocksource used until (and to
+ * calibrate) a better one.
+ */
+
+int pit_clocksource_init() {
+        uint8_t port_b = inb(PIT_CHANNEL_2_GATE_PORT) & ~(PIT_CHANNEL_2_SPEAKER | PIT_CHANNEL_2_GATE);
+        outb(PIT_CHANNEL_2_GATE_PORT, port_b);
+        outb(PIT_COMMAND_MODE_REGISTER, PIT_COMMAND_CHANNEL_2 | PIT_COMMAND_ACCESS_LOW_BYTE_HIGH_BYTE | PIT_COMMAND_MODE_RATE_GENERATOR | PIT_COMMAND_BINARY_MODE);
+
+        // A reload value of 0 stands for 65536.
+
+        outb(PIT_CHANNEL_2_DATA_REGISTER, 0);
+        outb(PIT_CHANNEL_2_DATA_REGISTER, 0);
+
+        // Counting starts on the rising edge of the gate.
+
+        outb(PIT_CHANNEL_2_GATE_PORT, port_b | PIT_CHANNEL_2_GATE);
+        pit_last_count = pit_get_counter_value(2);
+        return clocksource_register(&pit_clocksource);
+}
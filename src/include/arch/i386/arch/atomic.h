@@ -0,0 +1,219 @@
+#ifndef ATOMIC_H
+        #define ATOMIC_H
+
+        #include <stdbool.h>
+        #include <stdint.h>
+
+        /*
+        * Header only atomic operations for i386. Every locked instruction is a full memory barrier on x86 and all of them
+        * also act as compiler barriers (memory clobber), so no further ordering is needed around them.
+        */
+
+        /*
+        * Memory ordering. x86 only reorders later loads before earlier stores, so the smp_ variants (ordering between
+        * cpus for normal write back memory) are compiler barriers except for smp_mb(). The arch_ fences also order
+        * non temporal and write combining accesses (device memory).
+        */
+
+        static inline void arch_compiler_barrier(void) {
+                asm volatile("" : : : "memory");
+        }
+
+        static inline void arch_mb(void) {
+                asm volatile("mfence" : : : "memory");
+        }
+
+        static inline void arch_rmb(void) {
+                asm volatile("lfence" : : : "memory");
+        }
+
+        static inline void arch_wmb(void) {
+                asm volatile("sfence" : : : "memory");
+        }
+
+        // A locked operation on the stack is cheaper than mfence for ordering normal memory.
+
+        static inline void smp_mb(void) {
+                asm volatile("lock; addl $0, (%%esp)" : : : "memory", "cc");
+        }
+
+        static inline void smp_rmb(void) {
+                arch_compiler_barrier();
+        }
+
+        static inline void smp_wmb(void) {
+                arch_compiler_barrier();
+        }
+
+        /*
+        * Operations on plain 32 bit words.
+        */
+
+        static inline uint32_t arch_atomic_swap(uint32_t new_value, volatile uint32_t *target) {
+                asm volatile("xchgl %0, %1" : "+r" (new_value), "+m" (*target) : : "memory");
+                return new_value;
+        }
+
+        /*
+        * Atomically adds value to *target and returns the previous value of *target.
+        */
+
+        static inline uint32_t arch_atomic_fetch_add(uint32_t value, volatile uint32_t *target) {
+                asm volatile("lock; xaddl %0, %1" : "+r" (value), "+m" (*target) : : "memory");
+                return value;
+        }
+
+        static inline void arch_atomic_or(uint32_t value, volatile uint32_t *target) {
+                asm volatile("lock; orl %1, %0" : "+m" (*target) : "r" (value) : "memory");
+        }
+
+        static inline void arch_atomic_and(uint32_t value, volatile uint32_t *target) {
+                asm volatile("lock; andl %1, %0" : "+m" (*target) : "r" (value) : "memory");
+        }
+
+        /*
+        * Atomically replaces *target with new_value if it equals expected. Returns the previous value of *target.
+        */
+
+        static inline uint32_t arch_atomic_compare_exchange(uint32_t expected, uint32_t new_value, volatile uint32_t *target) {
+                asm volatile("lock; cmpxchgl %2, %1" : "+a" (expected), "+m" (*target) : "r" (new_value) : "memory");
+                return expected;
+        }
+
+        /*
+        * 64 bit compare and exchange (cmpxchg8b). Returns the previous value of *target.
+        */
+
+        static inline uint64_t arch_atomic_compare_exchange64(uint64_t expected, uint64_t new_value, volatile uint64_t *target) {
+                asm volatile("lock; cmpxchg8b %1" : "+A" (expected), "+m" (*target) : "b" ((uint32_t) new_value), "c" ((uint32_t) (new_value >> 32)) : "memory");
+                return expected;
+        }
+
+        /*
+        * Bit operations on bitmaps of 32 bit words, nr can be past the first word. The test_and variants return the previous bit value.
+        */
+
+        static inline void arch_set_bit(uint32_t nr, volatile uint32_t *bitmap) {
+                asm volatile("lock; btsl %1, %0" : "+m" (*bitmap) : "Ir" (nr) : "memory");
+        }
+
+        static inline void arch_clear_bit(uint32_t nr, volatile uint32_t *bitmap) {
+                asm volatile("lock; btrl %1, %0" : "+m" (*bitmap) : "Ir" (nr) : "memory");
+        }
+
+        static inline bool arch_test_and_set_bit(uint32_t nr, volatile uint32_t *bitmap) {
+                bool old;
+                asm volatile("lock; btsl %2, %0" : "+m" (*bitmap), "=@ccc" (old) : "Ir" (nr) : "memory");
+                return old;
+        }
+
+        static inline bool arch_test_and_clear_bit(uint32_t nr, volatile uint32_t *bitmap) {
+                bool old;
+                asm volatile("lock; btrl %2, %0" : "+m" (*bitmap), "=@ccc" (old) : "Ir" (nr) : "memory");
+                return old;
+        }
+
+        /*
+        * Atomic counters. Plain reads and writes of aligned 32 bit words are atomic, only read-modify-write needs a locked instruction.
+        */
+
+        typedef struct atomic {
+                volatile int32_t counter;
+        } atomic_t;
+
+        #define ATOMIC_INIT(value) { counter: (value) }
+
+        static inline int32_t atomic_read(const atomic_t *atomic) {
+                return atomic->counter;
+        }
+
+        static inline void atomic_set(atomic_t *atomic, int32_t value) {
+                atomic->counter = value;
+        }
+
+        static inline int32_t atomic_fetch_add(atomic_t *atomic, int32_t value) {
+                return (int32_t) arch_atomic_fetch_add((uint32_t) value, (volatile uint32_t*) &atomic->counter);
+        }
+
+        static inline int32_t atomic_add_return(atomic_t *atomic, int32_t value) {
+                return atomic_fetch_add(atomic, value) + value;
+        }
+
+        static inline void atomic_add(atomic_t *atomic, int32_t value) {
+                asm volatile("lock; addl %1, %0" : "+m" (atomic->counter) : "ir" (value) : "memory");
+        }
+
+        static inline void atomic_sub(atomic_t *atomic, int32_t value) {
+                asm volatile("lock; subl %1, %0" : "+m" (atomic->counter) : "ir" (value) : "memory");
+        }
+
+        static inline void atomic_inc(atomic_t *atomic) {
+                asm volatile("lock; incl %0" : "+m" (atomic->counter) : : "memory");
+        }
+
+        static inline void atomic_dec(atomic_t *atomic) {
+                asm volatile("lock; decl %0" : "+m" (atomic->counter) : : "memory");
+        }
+
+        /*
+        * Decrements the counter and returns true if it reached zero.
+        */
+
+        static inline bool atomic_dec_and_test(atomic_t *atomic) {
+                bool zero;
+                asm volatile("lock; decl %0" : "+m" (atomic->counter), "=@ccz" (zero) : : "memory");
+                return zero;
+        }
+
+        static inline int32_t atomic_xchg(atomic_t *atomic, int32_t value) {
+                return (int32_t) arch_atomic_swap((uint32_t) value, (volatile uint32_t*) &atomic->counter);
+        }
+
+        static inline int32_t atomic_cmpxchg(atomic_t *atomic, int32_t expected, int32_t new_value) {
+                return (int32_t) arch_atomic_compare_exchange((uint32_t) expected, (uint32_t) new_value, (volatile uint32_t*) &atomic->counter);
+        }
+
+        /*
+        * 64 bit counters, built on cmpxchg8b as i386 has no 64 bit loads or stores in general purpose registers.
+        */
+
+        typedef struct atomic64 {
+                volatile uint64_t counter;
+        } __attribute__((aligned(8))) atomic64_t;
+
+        #define ATOMIC64_INIT(value) { counter: (value) }
+
+        /*
+        * A compare and exchange that never succeeds (expected equals new value) returns the current value atomically.
+        */
+
+        static inline uint64_t atomic64_read(atomic64_t *atomic) {
+                return arch_atomic_compare_exchange64(0, 0, &atomic->counter);
+        }
+
+        static inline uint64_t atomic64_cmpxchg(atomic64_t *atomic, uint64_t expected, uint64_t new_value) {
+                return arch_atomic_compare_exchange64(expected, new_value, &atomic->counter);
+        }
+
+        static inline void atomic64_set(atomic64_t *atomic, uint64_t value) {
+                uint64_t old = atomic->counter;
+                uint64_t seen;
+                while ((seen = arch_atomic_compare_exchange64(old, value, &atomic->counter)) != old) {
+                        old = seen;
+                }
+        }
+
+        static inline uint64_t atomic64_fetch_add(atomic64_t *atomic, uint64_t value) {
+                uint64_t old = atomic->counter;
+                uint64_t seen;
+                while ((seen = arch_atomic_compare_exchange64(old, old + value, &atomic->counter)) != old) {
+                        old = seen;
+                }
+                return old;
+        }
+
+        static inline void atomic64_add(atomic64_t *atomic, uint64_t value) {
+                atomic64_fetch_add(atomic, value);
+        }
+
+#endif /** ATOMIC_H */
@@ -6,7 +6,9 @@
                 #include <stdbool.h>
                 #include <stddef.h>
                 #include <stdint.h>
+                #include <arch/atomic.h>
                 #include <arch/types.h>
+                #include <arch/cpu/topology.h>
 
         #endif /** __ASSEMBLER__ */
 
@@ -107,27 +109,56 @@
         #define CR0_PAGING_DISABLED 0
         #define CR0_PAGING_SHIFT 31
 
+        /*
+        * CR4 register definitions.
+        */
+
+        #define CR4_OS_FXSAVE_FXRSTOR_SUPPORT (1 << 9)
+        #define CR4_OS_FXSAVE_FXRSTOR_SUPPORT_SHIFT 9
+        #define CR4_OS_UNMASKED_SIMD_EXCEPTIONS (1 << 10)
+        #define CR4_OS_UNMASKED_SIMD_EXCEPTIONS_SHIFT 10
+
         #ifndef __ASSEMBLER__
 
                 typedef struct cpu_data {
                         uint8_t lapic_id;
                         bool bsp;
                         virt_addr_t *gdt;
-                        struct cpu_data *cpu;
+                        cpu_topology_t topology;
                 } cpu_data_t;
 
                 extern cpu_data_t *cpu_data;
-                extern cpu_data_t *cpu asm("%gs:0");
-                extern void* cpu_data_2 asm("%gs:4");
 
-                // xchg.S
+                /*
+                * cpu is the per cpu variable per_cpu__cpu (see arch/cpu/percpu.h) pointing to the cpu_data of the running cpu.
+                * The assembler name makes every access a %gs relative one.
+                */
 
-                extern uint32_t _xchg(uint32_t, volatile uint32_t*);
+                extern cpu_data_t *cpu asm("%gs:per_cpu__cpu");
+
+                // smp.c
+
+                uint8_t get_lapic_id(void);
+                cpu_data_t* get_cpu_data(uint8_t);
 
                 static inline void load_gs(uint16_t gs) {
                         asm volatile("movw %0, %%gs" : : "r" (gs));
                 }
 
+                static inline void load_tr(uint16_t tr) {
+                        asm volatile("ltr %0" : : "r" (tr));
+                }
+
+                static inline uint64_t read_msr(uint32_t msr) {
+                        uint64_t value;
+                        asm volatile("rdmsr" : "=A" (value) : "c" (msr));
+                        return value;
+                }
+
+                static inline void write_msr(uint32_t msr, uint64_t value) {
+                        asm volatile("wrmsr" : : "c" (msr), "A" (value));
+                }
+
                 static inline uint32_t read_eflags(void) {
                         uint32_t eflags;
                         asm volatile("pushfl; popl %0" : "=r" (eflags));
@@ -150,10 +181,38 @@
                         return cr2;
                 }
 
+                static inline uint32_t read_cr3(void) {
+                        uint32_t cr3;
+                        asm volatile("movl %%cr3, %0;" : "=r" (cr3));
+                        return cr3;
+                }
+
+                static inline void write_cr3(uint32_t cr3) {
+                        asm volatile("movl %0, %%cr3;" : : "r" (cr3) : "memory");
+                }
+
+                static inline uint32_t read_cr4(void) {
+                        uint32_t cr4;
+                        asm volatile("movl %%cr4, %0;" : "=r" (cr4));
+                        return cr4;
+                }
+
+                static inline void write_cr4(uint32_t cr4) {
+                        asm volatile("movl %0, %%cr4;" : : "r" (cr4));
+                }
+
                 static inline void arch_halt(void) {
                         asm volatile("hlt");
                 }
 
+                /*
+                * sti only takes effect after the next instruction, so an interrupt arriving in between wakes up the hlt.
+                */
+
+                static inline void arch_sti_halt(void) {
+                        asm volatile("sti; hlt" : : : "memory");
+                }
+
                 static inline void arch_cli(void) {
                         asm volatile("cli");
                 }
@@ -162,10 +221,32 @@
                         asm volatile("sti");
                 }
 
-                static inline uint32_t arch_atomic_swap(uint32_t new_value, volatile uint32_t *lock) {
-                        return _xchg(new_value, lock);
+                /*
+                * Disables interrupts and returns the previous eflags, to be given back to arch_irq_restore().
+                */
+
+                static inline uint32_t arch_irq_save(void) {
+                        uint32_t eflags = read_eflags();
+                        arch_cli();
+                        return eflags;
+                }
+
+                static inline void arch_irq_restore(uint32_t eflags) {
+                        if (eflags & EFLAGS_INTERRUPT_ENABLE_FLAG_SET) {
+                                arch_sti();
+                        }
+                }
+
+                static inline void arch_pause(void) {
+                        asm volatile("pause");
+                }
+
+                static inline uint64_t read_tsc(void) {
+                        uint64_t tsc;
+                        asm volatile("rdtsc" : "=A" (tsc));
+                        return tsc;
                 }
-                
+
         #endif /** __ASSEMBLER__ */
 
 #endif /** CPU_H */
\ No newline at end of file
@@ -3,6 +3,13 @@
 
         #include <stdint.h>
 
+        /*
+        * Vectors handed out by interrupt_vector_alloc(), between the io apic irqs and the local apic timer.
+        */
+
+        #define INTERRUPT_DYNAMIC_VECTOR_START 0x70
+        #define INTERRUPT_DYNAMIC_VECTOR_END 0xEE
+
         struct context {
                 uint32_t kernel_ss, ds, es, fs, gs;
                 uint32_t edi, esi, ebp, ignore, ebx, edx, ecx, eax;
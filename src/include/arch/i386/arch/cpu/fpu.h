@@ -0,0 +1,52 @@
+#ifndef FPU_H
+        #define FPU_H
+
+        #include <stdbool.h>
+        #include <stddef.h>
+        #include <stdint.h>
+        #include <arch/cpu/cpu.h>
+
+        #define FPU_STATE_SIZE 512
+        #define FPU_NO_CPU ((size_t) -1)
+
+        /*
+        * Default MXCSR value: every SIMD floating point exception masked, round to nearest.
+        */
+
+        #define FPU_MXCSR_DEFAULT 0x1F80
+
+        /*
+        * FPU/SSE context of a thread, in the FXSAVE format. It is only valid once initialized is true: a thread gets a clean
+        * state the first time it uses the FPU. last_cpu is the cpu whose registers were last loaded with this state.
+        */
+
+        typedef struct fpu {
+                uint8_t state[FPU_STATE_SIZE] __attribute__((aligned(16)));
+                bool initialized;
+                size_t last_cpu;
+        } fpu_t;
+
+        static inline void fpu_clts(void) {
+                asm volatile("clts");
+        }
+
+        static inline void fpu_stts(void) {
+                write_cr0(read_cr0() | (1 << CR0_TASK_SHIFT));
+        }
+
+        static inline void fpu_fxsave(fpu_t *fpu) {
+                asm volatile("fxsave %0" : "=m" (fpu->state));
+        }
+
+        static inline void fpu_fxrstor(fpu_t *fpu) {
+                asm volatile("fxrstor %0" : : "m" (fpu->state));
+        }
+
+        void fpu_state_init(fpu_t*);
+        void fpu_switch(fpu_t*, fpu_t*);
+        void fpu_device_not_available(void);
+        bool kernel_fpu_usable(void);
+        void kernel_fpu_begin(void);
+        void kernel_fpu_end(void);
+
+#endif /** FPU_H */
@@ -10,12 +10,21 @@
         #define GDT_USER_CODE_OFFSET 0x18
         #define GDT_USER_DATA_OFFSET 0x20
         #define GDT_KERNEL_PER_CPU_DATA_OFFSET 0x28
+        #define GDT_TSS_OFFSET 0x30
 
         /*
-        * NULL segment, kernel code and data segments, user code and data segments and per cpu segment.
+        * Selectors of the user segments, with the requested privilege level set to 3.
         */
 
-        #define GDT_MAX_ENTRIES 6
+        #define GDT_USER_CODE_SELECTOR (GDT_USER_CODE_OFFSET | 0x3)
+        #define GDT_USER_DATA_SELECTOR (GDT_USER_DATA_OFFSET | 0x3)
+
+        /*
+        * NULL segment, kernel code and data segments, user code and data segments, per cpu segment and task state segment.
+        * SYSENTER/SYSEXIT rely on this order: kernel data follows kernel code, user code and data follow kernel data.
+        */
+
+        #define GDT_MAX_ENTRIES 7
 
         /* 
         * GDT definitions:
@@ -102,6 +111,8 @@
                 #define SEGMENT_KCODE(base, limit) SEGMENT(base, limit, 0, 1, 0, 1, 1, 0, 1, 0, 0, 1, 1)
                 #define SEGMENT_KDATA(base, limit) SEGMENT(base, limit, 0, 1, 0, 0, 1, 0, 1, 0, 0, 1, 1)
                 #define SEGMENT_CPU_DATA(base, limit) SEGMENT(base, limit, 0, 1, 0, 0, 1, 0, 1, 0, 0, 1, 1)
+                #define SEGMENT_UCODE(base, limit) SEGMENT(base, limit, 0, 1, 0, 1, 1, 0xC0000000, 1, 0, 0, 1, 1)
+                #define SEGMENT_UDATA(base, limit) SEGMENT(base, limit, 0, 1, 0, 0, 1, 0xC0000000, 1, 0, 0, 1, 1)
 
                 void gdt_init(uint8_t);
 
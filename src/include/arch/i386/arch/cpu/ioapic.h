@@ -1,6 +1,67 @@
 #ifndef IOAPIC_H
         #define IOAPIC_H
 
-        
+        #include <stdbool.h>
+        #include <stddef.h>
+        #include <stdint.h>
 
-        #endif /** IOPIC_H */
\ No newline at end of file
+        /*
+        * Memory mapped registers: the register index is written to IOREGSEL and the register is accessed through IOWIN.
+        */
+
+        #define IOAPIC_REGISTER_SELECT 0x0
+        #define IOAPIC_WINDOW 0x10
+
+        #define IOAPIC_ID_REGISTER 0x0
+        #define IOAPIC_VERSION_REGISTER 0x1
+        #define IOAPIC_VERSION_MAX_REDIRECTION_ENTRY(register) (((register) >> 16) & 0xFF)
+        #define IOAPIC_REDIRECTION_TABLE_REGISTER(pin) (0x10 + ((pin) * 2))
+
+        /*
+        * Redirection table entry definitions (low dword, the destination local apic id is in bits 24 - 31 of the high dword).
+        */
+
+        #define IOAPIC_REDIRECTION_DELIVERY_MODE_FIXED 0x0
+        #define IOAPIC_REDIRECTION_DESTINATION_MODE_PHYSICAL 0x0
+        #define IOAPIC_REDIRECTION_POLARITY_ACTIVE_HIGH 0x0
+        #define IOAPIC_REDIRECTION_POLARITY_ACTIVE_LOW (1 << 13)
+        #define IOAPIC_REDIRECTION_TRIGGER_MODE_EDGE 0x0
+        #define IOAPIC_REDIRECTION_TRIGGER_MODE_LEVEL (1 << 15)
+        #define IOAPIC_REDIRECTION_MASKED (1 << 16)
+        #define IOAPIC_REDIRECTION_DESTINATION_SHIFT 24
+
+        #define IOAPIC_MAX 8
+
+        /*
+        * Irq numbers 0 - 15 are the legacy ISA irqs (connected to the global system interrupt the firmware says), higher
+        * irq numbers are global system interrupts. Irq n is delivered on vector IOAPIC_VECTOR_BASE + n, right after the
+        * range of the (masked) PIC.
+        */
+
+        #define IOAPIC_ISA_IRQS 16
+        #define IOAPIC_MAX_IRQS 64
+        #define IOAPIC_VECTOR_BASE 48
+        #define IOAPIC_IRQ_VECTOR(irq) (IOAPIC_VECTOR_BASE + (irq))
+
+        /*
+        * Passed as cpu to let the driver pick the destination of an irq.
+        */
+
+        #define IOAPIC_CPU_ANY ((size_t) -1)
+
+        typedef struct ioapic {
+                uint8_t id;
+                uint32_t *address;
+                uint32_t global_system_interrupt_base;
+                uint32_t num_pins;
+        } ioapic_t;
+
+        extern size_t num_ioapics;
+
+        int ioapic_init(void);
+        int ioapic_set_affinity(uint8_t, size_t);
+        int ioapic_enable_irq(uint8_t);
+        int ioapic_disable_irq(uint8_t);
+        size_t ioapic_irq_cpu(uint8_t);
+
+#endif /** IOAPIC_H */
@@ -1,6 +1,9 @@
 #ifndef LAPIC_H
         #define LAPIC_H
 
+        #include <stdbool.h>
+        #include <stdint.h>
+
         #define LAPIC_ID_REGISTER 0x20
         #define LAPIC_VERSION_REGISTER 0x30
         #define LAPIC_TASK_PRIORITY_REGISTER 0x80
@@ -63,16 +66,52 @@
         #define LAPIC_ICR_LEVEL_DE_ASSERT 0x0
         #define LAPIC_ICR_LEVEL_ASSERT (0x1 << 14)
         #define LAPIC_ICR_TRIGGER_MODE_EDGE 0x0
-        #define LAPIC_ICR_TRIGGER_MODE_LEVEL 0x1
+        #define LAPIC_ICR_TRIGGER_MODE_LEVEL (0x1 << 15)
         #define LAPIC_ICR_DESTINATION_NO_SHORTHAND 0x0
         #define LAPIC_ICR_DESTINATION_SELF (0x1 << 18)
         #define LAPIC_ICR_DESTINATION_ALL_INCLUDING_SELF (0x2 << 18)
         #define LAPIC_ICR_DESTINATION_ALL_EXCLUDING_SELF (0x3 << 18)
 
+        /*
+        * Local vector table timer entry and divide configuration definitions.
+        */
+
+        #define LAPIC_LVT_MASKED (0x1 << 16)
+        #define LAPIC_LVT_TIMER_MODE_ONE_SHOT 0x0
+        #define LAPIC_LVT_TIMER_MODE_PERIODIC (0x1 << 17)
+        #define LAPIC_LVT_TIMER_MODE_TSC_DEADLINE (0x2 << 17)
+        #define LAPIC_DIVIDE_BY_16 0x3
+        #define LAPIC_TIMER_DIVIDER 16
+
+        #define CPUID_FEATURES_ECX_TSC_DEADLINE (1 << 24)
+        #define MSR_IA32_TSC_DEADLINE 0x6E0
+
+        /*
+        * Vector of the local timer interrupt, the highest one below the inter processor interrupts.
+        */
+
+        #define LAPIC_TIMER_VECTOR 0xEF
+
+        /*
+        * Modes of the per cpu tick (see lapic_timer_init()). The one shot modes let idle cpus stop their tick.
+        */
+
+        #define LAPIC_TIMER_MODE_PERIODIC 0
+        #define LAPIC_TIMER_MODE_ONE_SHOT 1
+        #define LAPIC_TIMER_MODE_TSC_DEADLINE 2
+        #define LAPIC_TIMER_MIN_DELTA_NS 1000
+
+        extern uint32_t lapic_timer_frequency;
+        extern bool tsc_deadline;
+
         void lapic_init(void);
         void lapic_write(uint32_t, uint32_t);
         uint32_t lapic_read(uint32_t);
         void lapic_send_ipi(uint8_t, uint32_t);
+        void lapic_wait_ipi_delivery(void);
         void lapic_send_eoi();
+        int lapic_timer_calibrate(void);
+        int lapic_timer_init(uint32_t);
+        void lapic_timer_stop(void);
 
 #endif /** LAPIC_H */
\ No newline at end of file
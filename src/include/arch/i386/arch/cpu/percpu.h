@@ -0,0 +1,113 @@
+#ifndef PERCPU_H
+        #define PERCPU_H
+
+        #include <stddef.h>
+        #include <stdint.h>
+        #include <arch/cpu/smp.h>
+        #include <arch/types.h>
+
+        /*
+        * Per cpu variables live in the .percpu section of the kernel image, which is only a template: at boot every cpu
+        * gets its own copy of it (the per cpu area) and the %gs segment of every cpu has base (area - _PERCPU_START_) and a 4Gb limit.
+        * This way the link time address of a per cpu variable used as a %gs relative offset addresses the copy of the running cpu
+        * (the 32 bit address computation wraps around) and every access compiles to a single instruction.
+        * Per cpu variables must only be accessed through the accessors below: the plain symbol refers to the template.
+        */
+
+        #define DEFINE_PER_CPU(type, name) __attribute__((section(".percpu"))) __typeof__(type) per_cpu__##name
+        #define DECLARE_PER_CPU(type, name) extern __typeof__(type) per_cpu__##name
+
+        /*
+        * Virtual addresses where the per cpu areas of the APs are mapped.
+        */
+
+        #define PERCPU_AREAS_START 0xD0400000
+
+        extern virt_addr_t _PERCPU_START_;
+        extern virt_addr_t _PERCPU_END_;
+        extern virt_addr_t _PERCPU_BSP_START_;
+        extern uintptr_t per_cpu_offset[MAX_CPUS];
+
+        DECLARE_PER_CPU(uintptr_t, this_cpu_offset);
+        DECLARE_PER_CPU(size_t, cpu_index);
+
+        static inline uintptr_t this_cpu_offset_read(void) {
+                uintptr_t offset;
+                asm volatile("movl %%gs:%1, %0" : "=r" (offset) : "m" (per_cpu__this_cpu_offset));
+                return offset;
+        }
+
+        /*
+        * Address of the copy of a per cpu variable that belongs to the cpu with the given index or to the running cpu.
+        */
+
+        #define per_cpu_ptr(name, index) ((__typeof__(&per_cpu__##name)) ((uintptr_t) &per_cpu__##name + per_cpu_offset[index]))
+        #define this_cpu_ptr(name) ((__typeof__(&per_cpu__##name)) ((uintptr_t) &per_cpu__##name + this_cpu_offset_read()))
+
+        /*
+        * Single instruction accessors for 1, 2 and 4 bytes variables. Other sizes fall back to this_cpu_ptr().
+        * this_cpu_add() is only meaningful for integer variables.
+        */
+
+        #define this_cpu_read(name) ({ \
+                union { __typeof__(per_cpu__##name) value; uint8_t u8; uint16_t u16; uint32_t u32; } __percpu; \
+                switch (sizeof(per_cpu__##name)) { \
+                        case 1: \
+                                asm volatile("movb %%gs:%1, %0" : "=q" (__percpu.u8) : "m" (per_cpu__##name)); \
+                                break; \
+                        case 2: \
+                                asm volatile("movw %%gs:%1, %0" : "=r" (__percpu.u16) : "m" (per_cpu__##name)); \
+                                break; \
+                        case 4: \
+                                asm volatile("movl %%gs:%1, %0" : "=r" (__percpu.u32) : "m" (per_cpu__##name)); \
+                                break; \
+                        default: \
+                                __percpu.value = *this_cpu_ptr(name); \
+                                break; \
+                } \
+                __percpu.value; \
+        })
+
+        #define this_cpu_write(name, val) do { \
+                union { __typeof__(per_cpu__##name) value; uint8_t u8; uint16_t u16; uint32_t u32; } __percpu; \
+                __percpu.value = (val); \
+                switch (sizeof(per_cpu__##name)) { \
+                        case 1: \
+                                asm volatile("movb %1, %%gs:%0" : "=m" (per_cpu__##name) : "qi" (__percpu.u8)); \
+                                break; \
+                        case 2: \
+                                asm volatile("movw %1, %%gs:%0" : "=m" (per_cpu__##name) : "ri" (__percpu.u16)); \
+                                break; \
+                        case 4: \
+                                asm volatile("movl %1, %%gs:%0" : "=m" (per_cpu__##name) : "ri" (__percpu.u32)); \
+                                break; \
+                        default: \
+                                *this_cpu_ptr(name) = __percpu.value; \
+                                break; \
+                } \
+        } while (0)
+
+        #define this_cpu_add(name, val) do { \
+                switch (sizeof(per_cpu__##name)) { \
+                        case 1: \
+                                asm volatile("addb %1, %%gs:%0" : "+m" (per_cpu__##name) : "qi" ((uint8_t) (val))); \
+                                break; \
+                        case 2: \
+                                asm volatile("addw %1, %%gs:%0" : "+m" (per_cpu__##name) : "ri" ((uint16_t) (val))); \
+                                break; \
+                        case 4: \
+                                asm volatile("addl %1, %%gs:%0" : "+m" (per_cpu__##name) : "ri" ((uint32_t) (val))); \
+                                break; \
+                        default: \
+                                *this_cpu_ptr(name) += (val); \
+                                break; \
+                } \
+        } while (0)
+
+        #define this_cpu_inc(name) this_cpu_add(name, 1)
+        #define this_cpu_dec(name) this_cpu_add(name, -1)
+
+        void percpu_init_bsp(void);
+        void percpu_init_aps(void);
+
+#endif /** PERCPU_H */
\ No newline at end of file
@@ -2,7 +2,9 @@
         #define MP_H
 
         #include <stdbool.h>
+        #include <stddef.h>
         #include <stdint.h>
+        #include <arch/atomic.h>
         #include <arch/types.h>
 
         extern bool smp;
@@ -10,6 +12,60 @@
         extern phys_addr_t local_apic_address;
         extern phys_addr_t io_apic_address;
 
+        /*
+        * Maximum number of cpus supported. Cpus past this limit are ignored during enumeration.
+        */
+
+        #define MAX_CPUS 64
+
+        /*
+        * Set of cpus, bit n refers to the cpu at index n of the cpu_data array.
+        */
+
+        typedef struct cpumask {
+                uint32_t bits[MAX_CPUS / 32];
+        } cpumask_t;
+
+        static inline void cpumask_set(cpumask_t *mask, size_t cpu) {
+                mask->bits[cpu / 32] |= 1U << (cpu % 32);
+        }
+
+        static inline void cpumask_clear(cpumask_t *mask, size_t cpu) {
+                mask->bits[cpu / 32] &= ~(1U << (cpu % 32));
+        }
+
+        /*
+        * Variants for masks updated concurrently by several cpus.
+        */
+
+        static inline void cpumask_set_atomic(cpumask_t *mask, size_t cpu) {
+                arch_set_bit(cpu, mask->bits);
+        }
+
+        static inline void cpumask_clear_atomic(cpumask_t *mask, size_t cpu) {
+                arch_clear_bit(cpu, mask->bits);
+        }
+
+        static inline bool cpumask_test(const cpumask_t *mask, size_t cpu) {
+                return mask->bits[cpu / 32] & (1U << (cpu % 32));
+        }
+
+        static inline size_t cpumask_weight(const cpumask_t *mask) {
+                size_t weight = 0;
+                for (size_t i = 0; i < MAX_CPUS / 32; i++) {
+                        for (uint32_t bits = mask->bits[i]; bits; bits &= bits - 1) {
+                                weight++;
+                        }
+                }
+                return weight;
+        }
+
+        /*
+        * Cpus that completed their initialization and can be the target of inter processor interrupts.
+        */
+
+        extern cpumask_t cpu_online_mask;
+
         /*
         * Intel MP spec definitions.
         *
@@ -150,6 +206,23 @@
                 uint8_t destination_io_apic_intin;
         } mp_configuration_table_io_apic_interrupt_entry_t;
 
+        /*
+        * ISA irqs the MP table connects to an io apic input, the flags use the same encoding as the ACPI MADT interrupt
+        * source overrides (polarity in bits 0 - 1, trigger mode in bits 2 - 3).
+        */
+
+        #define MP_MAX_IRQ_OVERRIDES 16
+
+        typedef struct mp_irq_override {
+                uint8_t source;
+                uint32_t global_system_interrupt;
+                uint16_t flags;
+        } mp_irq_override_t;
+
+        extern size_t mp_num_irq_overrides;
+        extern mp_irq_override_t mp_irq_overrides[MP_MAX_IRQ_OVERRIDES];
+        extern bool mp_imcr_present;
+
         /*
         * Local apic interrupt entry definitions.
         */
@@ -209,5 +282,6 @@
         } mp_floating_pointer_structure_t;
 
         void smp_init(void);
+        void smp_set_cpu_online(void);
 
 #endif /** MP_H */
\ No newline at end of file
@@ -0,0 +1,43 @@
+#ifndef SMP_CALL_H
+        #define SMP_CALL_H
+
+        #include <stdbool.h>
+        #include <stdint.h>
+        #include <arch/cpu/smp.h>
+
+        /*
+        * Vector of the inter processor interrupt used to run functions on other cpus.
+        * It sits in the highest priority class so that it is not blocked by device interrupts.
+        */
+
+        #define SMP_CALL_FUNCTION_VECTOR 0xF0
+
+        /*
+        * Vector of the inter processor interrupt used to make another cpu look at the scheduler run queue.
+        */
+
+        #define RESCHEDULE_VECTOR 0xF1
+
+        #define SMP_CALL_LOCKED 0x1
+        #define SMP_CALL_WAIT 0x2
+
+        typedef void (*smp_call_func_t)(void*);
+
+        /*
+        * A request queued on a target cpu. Every cpu owns one request per target cpu (see smp_call.c):
+        * it is locked (SMP_CALL_LOCKED) from the moment it is queued until the target is done with it.
+        */
+
+        typedef struct smp_call {
+                struct smp_call *next;
+                smp_call_func_t function;
+                void *arg;
+                volatile uint32_t flags;
+        } smp_call_t;
+
+        void smp_call_init(void);
+        int smp_call_function(const cpumask_t*, smp_call_func_t, void*, bool);
+        int smp_call_function_single(size_t, smp_call_func_t, void*, bool);
+        void smp_send_reschedule(size_t);
+
+#endif /** SMP_CALL_H */
@@ -0,0 +1,30 @@
+#ifndef SWITCH_H
+        #define SWITCH_H
+
+        #include <stdint.h>
+        #include <arch/types.h>
+
+        /*
+        * Virtual addresses where the kernel thread stacks are mapped (see kernel/sched/thread.c).
+        */
+
+        #define KTHREAD_STACKS_START 0xD1000000
+
+        void switch_context(uint32_t*, uint32_t);
+
+        /*
+        * Builds the frame switch_context() expects on a new stack: zeroed callee saved registers and entry as the return
+        * address. entry must never return, it finds a zero return address above it. Returns the initial stack pointer.
+        */
+
+        static inline uint32_t arch_thread_init_stack(virt_addr_t stack_top, void (*entry)(void)) {
+                uint32_t *stack = (uint32_t*) stack_top;
+                *--stack = 0;
+                *--stack = (uint32_t) entry;
+                for (int i = 0; i < 4; i++) {
+                        *--stack = 0;
+                }
+                return (uint32_t) stack;
+        }
+
+#endif /** SWITCH_H */
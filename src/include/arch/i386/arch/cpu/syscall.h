@@ -0,0 +1,45 @@
+#ifndef _SYSCALL_H
+        #define _SYSCALL_H
+
+        #include <stdbool.h>
+        #include <stdint.h>
+
+        #define CPUID_FEATURES_EDX_SEP (1 << 11)
+
+        #define MSR_SYSENTER_CS 0x174
+        #define MSR_SYSENTER_ESP 0x175
+        #define MSR_SYSENTER_EIP 0x176
+
+        /*
+        * System calls enter through SYSENTER. SYSENTER does not save the user stack pointer and return address, so the caller
+        * passes them in %ecx and %edx: the kernel returns there with SYSEXIT, which takes them from the same registers.
+        * The entry frame only holds those two registers and %gs, every other register is preserved by the C calling convention
+        * or is an argument. The kernel runs system calls with interrupts disabled, on the esp0 stack of the cpu task state segment.
+        */
+
+        /*
+        * User mode state of a thread: the kernel stack pointer arch_enter_user() returns on and the esp0 its kernel entries
+        * run on. The running thread keeps them in per cpu variables, user_context_switch() saves and loads them on every
+        * context switch so that they follow the thread when it is preempted or migrated.
+        */
+
+        typedef struct user_context {
+                uint32_t return_esp;
+                uint32_t esp0;
+        } user_context_t;
+
+        extern bool sysenter;
+
+        int syscall_init(void);
+        void user_context_switch(user_context_t*, user_context_t*);
+
+        /*
+        * Enters user mode at eip with the stack pointer esp and the current interrupt flag, which user mode keeps across system
+        * calls. Returns the code given to arch_leave_user(), called by the SYS_EXIT system call, with the flags it was called
+        * with. A thread runs one user context at a time.
+        */
+
+        int arch_enter_user(uint32_t, uint32_t);
+        void arch_leave_user(int) __attribute__((noreturn));
+
+#endif /** _SYSCALL_H */
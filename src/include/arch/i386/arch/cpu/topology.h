@@ -0,0 +1,57 @@
+#ifndef TOPOLOGY_H
+        #define TOPOLOGY_H
+
+        #include <stdbool.h>
+        #include <stddef.h>
+        #include <stdint.h>
+        #include <arch/cpu/smp.h>
+
+        /*
+        * CPUID leaves used for topology enumeration.
+        */
+
+        #define CPUID_LEAF_VENDOR 0x0
+        #define CPUID_LEAF_FEATURES 0x1
+        #define CPUID_LEAF_DETERMINISTIC_CACHE_PARAMETERS 0x4
+        #define CPUID_LEAF_EXTENDED_TOPOLOGY 0xB
+        #define CPUID_FEATURES_EDX_HTT (1 << 28)
+        #define CPUID_CACHE_TYPE_NULL 0x0
+        #define CPUID_EXTENDED_TOPOLOGY_LEVEL_TYPE_INVALID 0x0
+        #define CPUID_EXTENDED_TOPOLOGY_LEVEL_TYPE_SMT 0x1
+        #define CPUID_EXTENDED_TOPOLOGY_LEVEL_TYPE_CORE 0x2
+
+        #define TOPOLOGY_CACHE_LEVELS 3
+        #define TOPOLOGY_CACHE_UNKNOWN 0xFF
+
+        /*
+        * Topology of a logical processor. The identifiers are extracted from the (x2)apic id of the cpu:
+        * the lowest smt_shift bits select the thread inside a core, the bits up to package_shift select the
+        * core inside a package and the remaining bits select the package. cache_shift[level - 1] is the number
+        * of low apic id bits that differ between cpus sharing the cache of that level (TOPOLOGY_CACHE_UNKNOWN if unknown).
+        * The masks are filled by topology_build_masks() once every cpu is online and always include the cpu itself.
+        */
+
+        typedef struct cpu_topology {
+                uint32_t apic_id;
+                uint32_t package_id;
+                uint32_t core_id;
+                uint32_t thread_id;
+                uint8_t smt_shift;
+                uint8_t package_shift;
+                uint8_t cache_shift[TOPOLOGY_CACHE_LEVELS];
+                cpumask_t smt_siblings;
+                cpumask_t package_siblings;
+                cpumask_t l2_siblings;
+                cpumask_t l3_siblings;
+        } cpu_topology_t;
+
+        void topology_init(void);
+        void topology_build_masks(void);
+        const cpu_topology_t* topology_get(size_t);
+        const cpumask_t* topology_smt_siblings(size_t);
+        const cpumask_t* topology_package_siblings(size_t);
+        const cpumask_t* topology_cache_siblings(size_t, uint8_t);
+        bool topology_share_cache(size_t, size_t, uint8_t);
+        size_t topology_num_packages(void);
+
+#endif /** TOPOLOGY_H */
\ No newline at end of file
@@ -0,0 +1,54 @@
+#ifndef TRAMPOLINE_H
+        #define TRAMPOLINE_H
+
+        #ifndef __ASSEMBLER__
+                #include <stdint.h>
+                #include <arch/types.h>
+        #endif
+
+        /*
+        * The AP trampoline (boot_ap.S) is copied to AP_TRAMPOLINE_ADDRESS and reads its parameters from the page at
+        * AP_BOOT_PARAMETERS_ADDRESS. Both pages are reserved by the physical memory manager when SMP is detected.
+        * All the APs are started at once, every AP indexes the stacks array with its local apic identifier and halts if its
+        * entry is 0 (the BSP, processors disabled by the firmware or past MAX_CPUS).
+        */
+
+        #define AP_TRAMPOLINE_ADDRESS 0x1000
+        #define AP_BOOT_PARAMETERS_ADDRESS 0x2000
+        #define AP_BOOT_PARAMETERS_PAGE_DIRECTORY_OFFSET 0x0
+        #define AP_BOOT_PARAMETERS_ENTRY_OFFSET 0x4
+        #define AP_BOOT_PARAMETERS_STACKS_OFFSET 0x8
+
+        /*
+        * One entry per xAPIC identifier (cpuid leaf 1 reports 8 bits).
+        */
+
+        #define AP_BOOT_STACKS 256
+
+        /*
+        * The boot stack of an AP becomes the stack of its idle thread, which also takes interrupts, softirqs and callbacks.
+        * Like the kernel thread stacks (see kernel/thread.h) every stack has AP_STACK_PAGES pages preceded by an unmapped guard
+        * page, the stacks are laid out one after the other from AP_STACKS_START.
+        */
+
+        #define AP_STACKS_START 0xD0000000
+        #define AP_STACK_PAGES 2
+        #define AP_STACK_SLOT_SIZE ((AP_STACK_PAGES + 1) * 0x1000)
+
+        /*
+        * Milliseconds the BSP waits for all the APs to come online.
+        */
+
+        #define AP_BOOT_TIMEOUT 1000
+
+        #ifndef __ASSEMBLER__
+
+                typedef struct ap_boot_parameters {
+                        phys_addr_t page_directory;
+                        void (*entry)(uint8_t);
+                        virt_addr_t stacks[AP_BOOT_STACKS];
+                } ap_boot_parameters_t;
+
+        #endif /** __ASSEMBLER__ */
+
+#endif /** TRAMPOLINE_H */
\ No newline at end of file
@@ -0,0 +1,19 @@
+#ifndef TSC_H
+        #define TSC_H
+
+        #include <stdint.h>
+
+        #define CPUID_FEATURES_EDX_TSC (1 << 4)
+
+        /*
+        * Length of the measure of the TSC frequency against the boot clocksource.
+        */
+
+        #define TSC_CALIBRATION_MS 10
+        #define TSC_CLOCKSOURCE_RATING 300
+
+        extern uint64_t tsc_frequency;
+
+        int tsc_init(void);
+
+#endif /** TSC_H */
@@ -0,0 +1,37 @@
+#ifndef TSS_H
+        #define TSS_H
+
+        /*
+        * Offset of esp0 in the task state segment, used by the SYSENTER entry code.
+        */
+
+        #define TSS_ESP0_OFFSET 4
+
+        #ifndef __ASSEMBLER__
+                #include <stdint.h>
+                #include <arch/cpu/percpu.h>
+
+                /*
+                * Every cpu has its own task state segment, only used for the stack the cpu switches to when entering the kernel
+                * from user mode (ss0:esp0). iomap_base points past the limit, so user mode has no I/O port access.
+                */
+
+                typedef struct tss {
+                        uint16_t link, reserved0;
+                        uint32_t esp0;
+                        uint16_t ss0, reserved1;
+                        uint32_t esp1;
+                        uint16_t ss1, reserved2;
+                        uint32_t esp2;
+                        uint16_t ss2, reserved3;
+                        uint32_t cr3, eip, eflags, eax, ecx, edx, ebx, esp, ebp, esi, edi;
+                        uint16_t es, reserved4, cs, reserved5, ss, reserved6, ds, reserved7, fs, reserved8, gs, reserved9;
+                        uint16_t ldt, reserved10;
+                        uint16_t trap, iomap_base;
+                } __attribute__((packed)) tss_t;
+
+                DECLARE_PER_CPU(tss_t, tss);
+
+        #endif /** __ASSEMBLER__ */
+
+#endif /** TSS_H */
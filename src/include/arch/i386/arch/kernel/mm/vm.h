@@ -2,11 +2,15 @@
         #define _VM_H
 
         #include <stdbool.h>
+        #include <stddef.h>
         #include <stdint.h>
+        #include <arch/mmu.h>
         #include <arch/paging.h>
         #include <arch/types.h>
 
         #define RECURSIVE_DIRECTORY_START_REGION 0xFFC00000
+        #define RECURSIVE_DIRECTORY_ADDRESS 0xFFFFF000
+        #define RECURSIVE_DIRECTORY_ENTRY 1023
         #define PROT_PRESENT 0x1
         #define PROT_NOT_PRESENT 0x0
         #define PROT_READ 0x0
@@ -20,11 +24,62 @@
         #define PROT_GLOBAL 0x100
         #define PROT_NOT_GLOBAL 0x0
 
+        /*
+        * The kernel half of every address space (directory entries 768 - 1023) is shared by reference.
+        * All the kernel page tables are preallocated at boot by vm_init() so that the kernel half of
+        * kernel_directory never changes after initialization and can simply be copied into new directories.
+        */
+
+        #define KERNEL_DIRECTORY_FIRST_ENTRY 768
+        #define KERNEL_DIRECTORY_ENTRIES 256
+
+        /*
+        * Directory entry 1022 is the kernel window: a page table used to temporarily map physical frames
+        * (page directories of other address spaces and per cpu scratch pages) into the kernel.
+        * The last num_cpus slots of the window are reserved as per cpu scratch slots.
+        */
+
+        #define VM_WINDOW_ENTRY 1022
+        #define VM_WINDOW_START 0xFF800000
+        #define VM_WINDOW_SLOTS 1024
+        #define VM_WINDOW_SLOT_ADDRESS(slot) ((virt_addr_t) VM_WINDOW_START + ((slot) * PAGE_SIZE))
+
+        /*
+        * Page table page cache. Every cpu keeps a stock of pre-zeroed page table frames so that allocating a page table
+        * is a pointer pop. The stock is refilled from the physical memory manager PT_CACHE_BATCH frames at a time and
+        * freed page tables are zeroed and pushed back, overflowing to a deferred free list which is returned to the
+        * physical memory manager in one batch when full.
+        */
+
+        #define PT_CACHE_STOCK_SIZE 16
+        #define PT_CACHE_BATCH 8
+
+        typedef struct pt_cache {
+                phys_addr_t stock[PT_CACHE_STOCK_SIZE];
+                size_t stock_count;
+                phys_addr_t deferred[PT_CACHE_BATCH];
+                size_t deferred_count;
+        } pt_cache_t;
+
+        typedef struct address_space {
+                page_directory_t *directory;
+                phys_addr_t directory_physical;
+                size_t window_slot;
+        } address_space_t;
+
         extern void flush_tlb_single(virt_addr_t);
+        extern void flush_tlb_all(void);
         extern page_directory_t kernel_directory;
+        extern address_space_t kernel_address_space;
 
+        void vm_init(void);
         int map_page(phys_addr_t, virt_addr_t, uint16_t, bool);
         int unmap_page(virt_addr_t);
+        void* vm_map_scratch(phys_addr_t);
+        void vm_unmap_scratch(void);
+        int create_address_space(address_space_t*);
+        void destroy_address_space(address_space_t*);
+        void switch_address_space(address_space_t*);
         void do_page_fault(virt_addr_t);
 
 #endif /** _VM_H */
\ No newline at end of file
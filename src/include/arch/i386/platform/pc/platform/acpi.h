@@ -0,0 +1,161 @@
+#ifndef ACPI_H
+        #define ACPI_H
+
+        /*
+        * Minimal ACPI tables parser. Only what is needed to discover the interrupt controllers and the processors
+        * of the system (the MADT) is implemented.
+        */
+
+        #include <stdbool.h>
+        #include <stddef.h>
+        #include <stdint.h>
+        #include <arch/types.h>
+        #include <platform/multiboot2.h>
+
+        #define ACPI_RSDP_SIGNATURE "RSD PTR "
+        #define ACPI_RSDP_SIGNATURE_SIZE 8
+        #define ACPI_RSDP_REVISION_1 0
+        #define ACPI_RSDP_REVISION_2 2
+        #define ACPI_RSDT_SIGNATURE "RSDT"
+        #define ACPI_XSDT_SIGNATURE "XSDT"
+        #define ACPI_MADT_SIGNATURE "APIC"
+        #define ACPI_SDT_SIGNATURE_SIZE 4
+
+        /*
+        * Places to look for the RSDP if the bootloader did not pass it: the first Kilobyte of the EBDA and the BIOS ROM space.
+        */
+
+        #define ACPI_RSDP_EBDA_SEARCH_SIZE 0x400
+
+        /*
+        * ACPI tables can live anywhere in physical memory and are parsed before the physical memory manager is up.
+        * Directory entry 1021 is reserved for a statically allocated page table through which the tables are mapped.
+        */
+
+        #define ACPI_WINDOW_ENTRY 1021
+        #define ACPI_WINDOW_START 0xFF400000
+        #define ACPI_WINDOW_PAGES 1024
+
+        #define ACPI_MAX_LOCAL_APICS 256
+        #define ACPI_MAX_IO_APICS 8
+        #define ACPI_MAX_INTERRUPT_SOURCE_OVERRIDES 16
+
+        typedef struct acpi_rsdp {
+                char signature[8];
+                uint8_t checksum;
+                char oem_id[6];
+                uint8_t revision;
+                uint32_t rsdt_address;
+
+                // ACPI 2.0+ fields.
+
+                uint32_t length;
+                uint64_t xsdt_address;
+                uint8_t extended_checksum;
+                uint8_t reserved[3];
+        } __attribute__((packed)) acpi_rsdp_t;
+
+        #define ACPI_RSDP_REVISION_1_SIZE 20
+
+        typedef struct acpi_sdt_header {
+                char signature[4];
+                uint32_t length;
+                uint8_t revision;
+                uint8_t checksum;
+                char oem_id[6];
+                char oem_table_id[8];
+                uint32_t oem_revision;
+                uint32_t creator_id;
+                uint32_t creator_revision;
+        } __attribute__((packed)) acpi_sdt_header_t;
+
+        /*
+        * MADT definitions.
+        */
+
+        #define ACPI_MADT_FLAGS_PCAT_COMPAT 0x1
+        #define ACPI_MADT_ENTRY_LOCAL_APIC 0x0
+        #define ACPI_MADT_ENTRY_IO_APIC 0x1
+        #define ACPI_MADT_ENTRY_INTERRUPT_SOURCE_OVERRIDE 0x2
+        #define ACPI_MADT_ENTRY_LOCAL_APIC_ADDRESS_OVERRIDE 0x5
+        #define ACPI_MADT_LOCAL_APIC_FLAGS_ENABLED 0x1
+        #define ACPI_MADT_LOCAL_APIC_FLAGS_ONLINE_CAPABLE 0x2
+        #define ACPI_MADT_INTERRUPT_FLAGS_POLARITY_MASK 0x3
+        #define ACPI_MADT_INTERRUPT_FLAGS_POLARITY_CONFORMS_TO_BUS_SPECIFICATION 0x0
+        #define ACPI_MADT_INTERRUPT_FLAGS_POLARITY_ACTIVE_HIGH 0x1
+        #define ACPI_MADT_INTERRUPT_FLAGS_POLARITY_ACTIVE_LOW 0x3
+        #define ACPI_MADT_INTERRUPT_FLAGS_TRIGGER_MODE_SHIFT 0x2
+        #define ACPI_MADT_INTERRUPT_FLAGS_TRIGGER_MODE_MASK 0x3
+        #define ACPI_MADT_INTERRUPT_FLAGS_TRIGGER_MODE_CONFORMS_TO_BUS_SPECIFICATION 0x0
+        #define ACPI_MADT_INTERRUPT_FLAGS_TRIGGER_MODE_EDGE_TRIGGERED 0x1
+        #define ACPI_MADT_INTERRUPT_FLAGS_TRIGGER_MODE_LEVEL_TRIGGERED 0x3
+
+        typedef struct acpi_madt {
+                acpi_sdt_header_t header;
+                uint32_t local_apic_address;
+                uint32_t flags;
+        } __attribute__((packed)) acpi_madt_t;
+
+        typedef struct acpi_madt_entry_header {
+                uint8_t type;
+                uint8_t length;
+        } __attribute__((packed)) acpi_madt_entry_header_t;
+
+        typedef struct acpi_madt_local_apic_entry {
+                acpi_madt_entry_header_t header;
+                uint8_t acpi_processor_id;
+                uint8_t local_apic_id;
+                uint32_t flags;
+        } __attribute__((packed)) acpi_madt_local_apic_entry_t;
+
+        typedef struct acpi_madt_io_apic_entry {
+                acpi_madt_entry_header_t header;
+                uint8_t io_apic_id;
+                uint8_t reserved;
+                uint32_t io_apic_address;
+                uint32_t global_system_interrupt_base;
+        } __attribute__((packed)) acpi_madt_io_apic_entry_t;
+
+        typedef struct acpi_madt_interrupt_source_override_entry {
+                acpi_madt_entry_header_t header;
+                uint8_t bus;
+                uint8_t source;
+                uint32_t global_system_interrupt;
+                uint16_t flags;
+        } __attribute__((packed)) acpi_madt_interrupt_source_override_entry_t;
+
+        typedef struct acpi_madt_local_apic_address_override_entry {
+                acpi_madt_entry_header_t header;
+                uint16_t reserved;
+                uint64_t local_apic_address;
+        } __attribute__((packed)) acpi_madt_local_apic_address_override_entry_t;
+
+        /*
+        * Information gathered from the MADT.
+        */
+
+        typedef struct acpi_io_apic {
+                uint8_t id;
+                phys_addr_t address;
+                uint32_t global_system_interrupt_base;
+        } acpi_io_apic_t;
+
+        typedef struct acpi_interrupt_source_override {
+                uint8_t source;
+                uint32_t global_system_interrupt;
+                uint16_t flags;
+        } acpi_interrupt_source_override_t;
+
+        extern bool acpi;
+        extern phys_addr_t acpi_local_apic_address;
+        extern bool acpi_pcat_compat;
+        extern size_t acpi_num_local_apics;
+        extern uint8_t acpi_local_apic_ids[ACPI_MAX_LOCAL_APICS];
+        extern size_t acpi_num_io_apics;
+        extern acpi_io_apic_t acpi_io_apics[ACPI_MAX_IO_APICS];
+        extern size_t acpi_num_interrupt_source_overrides;
+        extern acpi_interrupt_source_override_t acpi_interrupt_source_overrides[ACPI_MAX_INTERRUPT_SOURCE_OVERRIDES];
+
+        int acpi_init(multiboot2_information_header_t*);
+
+#endif /** ACPI_H */
\ No newline at end of file
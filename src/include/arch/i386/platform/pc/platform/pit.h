@@ -1,6 +1,7 @@
 #ifndef PIT_H
         #define PIT_H
 
+        #include <stdbool.h>
         #include <stdint.h>
 
         #define PIT_CHANNEL_0_DATA_REGISTER 0x40
@@ -8,6 +9,25 @@
         #define PIT_CHANNEL_2_DATA_REGISTER 0x42
         #define PIT_COMMAND_MODE_REGISTER 0x43
 
+        // ISA irq of channel 0.
+
+        #define PIT_IRQ 0
+
+        // Input clock of the counters in Hz.
+
+        #define PIT_FREQUENCY 1193182
+
+        /*
+        * The gate of channel 2 and its output can be accessed through the keyboard controller port B,
+        * which makes channel 2 usable as a free running counter (see pit_clocksource_init()).
+        */
+
+        #define PIT_CHANNEL_2_GATE_PORT 0x61
+        #define PIT_CHANNEL_2_GATE 0x1
+        #define PIT_CHANNEL_2_SPEAKER 0x2
+        #define PIT_CHANNEL_2_OUTPUT 0x20
+        #define PIT_CLOCKSOURCE_RATING 110
+
         #define PIT_COMMAND_CHANNEL_0 0x0
         #define PIT_COMMAND_CHANNEL_1 0x80
         #define PIT_COMMAND_CHANNEL_2 0x40
@@ -54,5 +74,6 @@
         void pit_interrupt_on_terminal_count(uint16_t);
         void pit_interrupt_rate_generator(uint16_t);
         uint16_t pit_get_counter_value(uint8_t);
+        int pit_clocksource_init(void);
 
 #endif /** PIT_H */
\ No newline at end of file
@@ -0,0 +1,11 @@
+#ifndef BENCH_H
+        #define BENCH_H
+
+        /*
+        * Boot time microbenchmarks, only built when the kernel is compiled with BENCH=1.
+        */
+
+        void lock_bench(void);
+        void syscall_bench(void);
+
+#endif /** BENCH_H */
@@ -0,0 +1,38 @@
+#ifndef CLOCKEVENTS_H
+        #define CLOCKEVENTS_H
+
+        #include <stdbool.h>
+        #include <stdint.h>
+
+        /*
+        * A clock event device is a per cpu timer that raises an interrupt either periodically (at TICK_HZ) or once at a
+        * programmed time. Every cpu registers its own device from the cpu it belongs to, the device is only ever operated
+        * from that cpu and with interrupts disabled. Its event_handler is installed by the tick layer (see kernel/time/tick.c).
+        * Times and delays are in nanoseconds.
+        */
+
+        #define CLOCK_EVT_FEAT_PERIODIC 0x1
+        #define CLOCK_EVT_FEAT_ONESHOT 0x2
+
+        #define CLOCK_EVT_STATE_SHUTDOWN 0
+        #define CLOCK_EVT_STATE_PERIODIC 1
+        #define CLOCK_EVT_STATE_ONESHOT 2
+
+        typedef struct clock_event_device {
+                const char *name;
+                uint32_t features;
+                uint32_t state;
+                uint64_t min_delta_ns;
+                uint64_t max_delta_ns;
+                int (*set_state_periodic)(struct clock_event_device*);
+                int (*set_state_oneshot)(struct clock_event_device*);
+                int (*set_state_shutdown)(struct clock_event_device*);
+                int (*set_next_event)(uint64_t, struct clock_event_device*);
+                void (*event_handler)(struct clock_event_device*);
+        } clock_event_device_t;
+
+        int clockevents_register_device(clock_event_device_t*);
+        int clockevents_switch_state(clock_event_device_t*, uint32_t);
+        int clockevents_program_event(clock_event_device_t*, uint64_t, uint64_t);
+
+#endif /** CLOCKEVENTS_H */
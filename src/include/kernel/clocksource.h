@@ -0,0 +1,45 @@
+#ifndef CLOCKSOURCE_H
+        #define CLOCKSOURCE_H
+
+        #include <stdbool.h>
+        #include <stdint.h>
+
+        #define NSEC_PER_SEC 1000000000ULL
+        #define NSEC_PER_MSEC 1000000ULL
+        #define NSEC_PER_USEC 1000ULL
+
+        /*
+        * A clocksource is a free running counter of known frequency readable from every cpu. The one with the highest rating
+        * registered so far drives ktime_get_ns(). read() returns a 64 bits count, drivers of narrower counters extend them
+        * and set max_idle_ns to how long the counter may go unread (0 if there is no limit).
+        * Counts are converted to nanoseconds as (cycles * mult) >> shift, mult and shift are computed on registration.
+        */
+
+        typedef struct clocksource {
+                const char *name;
+                uint32_t rating;
+                uint64_t frequency;
+                uint64_t max_idle_ns;
+                uint32_t mult;
+                uint32_t shift;
+                uint64_t (*read)(struct clocksource*);
+        } clocksource_t;
+
+        /*
+        * Returns (value * mult) >> shift without losing the high bits of the 96 bits product. shift must not exceed 32.
+        */
+
+        static inline uint64_t mul_u64_u32_shr(uint64_t value, uint32_t mult, uint32_t shift) {
+                uint64_t result = ((uint64_t) (uint32_t) value * mult) >> shift;
+                uint32_t high = (uint32_t) (value >> 32);
+                if (high) {
+                        result += ((uint64_t) high * mult) << (32 - shift);
+                }
+                return result;
+        }
+
+        int clocksource_register(clocksource_t*);
+        uint64_t clocksource_max_idle_ns(void);
+        uint64_t ktime_get_ns(void);
+
+#endif /** CLOCKSOURCE_H */
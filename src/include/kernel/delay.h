@@ -0,0 +1,10 @@
+#ifndef DELAY_H
+        #define DELAY_H
+
+        #include <stdint.h>
+
+        void ndelay(uint32_t);
+        void udelay(uint32_t);
+        void mdelay(uint32_t);
+
+#endif /** DELAY_H */
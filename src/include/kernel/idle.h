@@ -0,0 +1,7 @@
+#ifndef IDLE_H
+        #define IDLE_H
+
+        void idle_wait(void);
+        void cpu_idle(void) __attribute__((noreturn));
+
+#endif /** IDLE_H */
@@ -4,9 +4,37 @@
         #include <stdint.h>
         #include <arch/cpu/exception_interrupt.h>
 
-        typedef void (*interrupt_handler_t)(void);
+        /*
+        * Return values of interrupt handlers: a handler sharing its vector returns INTERRUPT_NONE when its device did not
+        * raise the interrupt.
+        */
 
-        int register_interrupt_handler(uint8_t, interrupt_handler_t);
-        void unregister_interrupt_handler(uint8_t);
+        #define INTERRUPT_NONE 0
+        #define INTERRUPT_HANDLED 1
 
-#endif /** INTERRUPT_H */
\ No newline at end of file
+        /*
+        * Action flags. A vector can only have several actions if all of them are INTERRUPT_SHARED.
+        */
+
+        #define INTERRUPT_SHARED 0x1
+
+        typedef int (*interrupt_handler_t)(interrupt_context_t*, void*);
+
+        /*
+        * A handler registered on a vector, called with the interrupt context and dev_id. The action is owned by its caller
+        * and must stay untouched from register_interrupt_handler() to unregister_interrupt_handler().
+        */
+
+        typedef struct interrupt_action {
+                struct interrupt_action *next;
+                interrupt_handler_t handler;
+                void *dev_id;
+                uint32_t flags;
+        } interrupt_action_t;
+
+        int register_interrupt_handler(uint8_t, interrupt_action_t*);
+        int unregister_interrupt_handler(uint8_t, interrupt_action_t*);
+        int interrupt_vector_alloc(void);
+        int interrupt_vector_free(uint8_t);
+
+#endif /** INTERRUPT_H */
@@ -0,0 +1,37 @@
+#ifndef IRQSTAT_H
+        #define IRQSTAT_H
+
+        #include <stdint.h>
+        #include <arch/cpu/percpu.h>
+
+        /*
+        * Interrupt and exception statistics. Every cpu counts the events of every vector in its own per cpu area, so counting
+        * never writes shared memory nor needs atomic operations.
+        * When the kernel is compiled with IRQSTAT=1 every cpu also keeps, per interrupt vector, a histogram of the time stamp
+        * counter cycles from the entry of the dispatcher to the EOI: bucket 0 counts latencies below
+        * 2^IRQSTAT_HISTOGRAM_SHIFT cycles, every next bucket doubles the bound and the last one counts everything above.
+        */
+
+        #define IRQSTAT_VECTORS 256
+        #define IRQSTAT_HISTOGRAM_SHIFT 8
+        #define IRQSTAT_HISTOGRAM_BUCKETS 16
+
+        DECLARE_PER_CPU(uint32_t[IRQSTAT_VECTORS], irqstat_counts);
+
+        /*
+        * Must be called with interrupts disabled. Events raised before the per cpu areas are set up are not counted: until then
+        * the %gs segment of the cpu addresses the per cpu template.
+        */
+
+        static inline void irqstat_count(uint8_t vector) {
+                if (this_cpu_offset_read() != 0) {
+                        (*this_cpu_ptr(irqstat_counts))[vector]++;
+                }
+        }
+
+        #ifdef IRQSTAT
+                void irqstat_latency(uint8_t, uint64_t);
+        #endif
+        void irqstat_dump(void);
+
+#endif /** IRQSTAT_H */
@@ -0,0 +1,29 @@
+#ifndef LOCKSTAT_H
+        #define LOCKSTAT_H
+
+        #include <stdbool.h>
+        #include <stdint.h>
+        #include <kernel/spinlock.h>
+
+        /*
+        * Lock contention statistics, only built when the kernel is compiled with LOCKSTAT=1.
+        * A spinlock_t is registered the first time it is taken and its counters are kept per cpu, so recording
+        * never needs atomic operations. Spin and hold times are in time stamp counter cycles.
+        */
+
+        #define LOCKSTAT_MAX_LOCKS 32
+
+        typedef struct lockstat {
+                uint64_t acquisitions;
+                uint64_t contended;
+                uint64_t spin_cycles;
+                uint64_t spin_cycles_max;
+                uint64_t hold_cycles;
+                uint64_t hold_cycles_max;
+        } lockstat_t;
+
+        void lockstat_acquired(spinlock_t*, bool, uint64_t);
+        void lockstat_released(spinlock_t*);
+        void lockstat_dump(void);
+
+#endif /** LOCKSTAT_H */
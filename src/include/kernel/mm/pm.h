@@ -2,6 +2,7 @@
         #define PM_H
 
         #include <stdbool.h>
+        #include <stddef.h>
         #include <stdint.h>
         #include <arch/mmu.h>
         #include <arch/types.h>
@@ -21,6 +22,16 @@
                 struct bitmap_list *next;
         } bitmap_list_t;
 
+        /*
+        * Snapshot of the physical memory manager counters, in blocks.
+        */
+
+        typedef struct pm_stats {
+                size_t total_blocks;
+                size_t reserved_blocks;
+                size_t used_blocks;
+        } pm_stats_t;
+
         /*
         * Exported by the linker script.
         */
@@ -29,6 +40,9 @@
         extern virt_addr_t _KERNEL_END_;
 
         phys_addr_t get_free_frame(void);
+        size_t get_free_frames(phys_addr_t*, size_t);
         void free_frame(phys_addr_t);
+        void free_frames(phys_addr_t*, size_t);
+        void pm_get_stats(pm_stats_t*);
 
 #endif /** PM_H */
\ No newline at end of file
@@ -0,0 +1,35 @@
+#ifndef PREEMPT_H
+        #define PREEMPT_H
+
+        #include <stdbool.h>
+        #include <stdint.h>
+        #include <arch/cpu/cpu.h>
+        #include <arch/cpu/percpu.h>
+
+        /*
+        * Per cpu nesting counts. preempt_count is the number of spinlocks (or explicit preempt_disable() calls) held by the
+        * running cpu, irq_count the number of interrupt handlers it is running. A cpu may only be preempted when both are zero.
+        */
+
+        DECLARE_PER_CPU(uint32_t, preempt_count);
+        DECLARE_PER_CPU(uint32_t, irq_count);
+
+        static inline void preempt_disable(void) {
+                this_cpu_inc(preempt_count);
+                arch_compiler_barrier();
+        }
+
+        static inline void preempt_enable(void) {
+                arch_compiler_barrier();
+                this_cpu_dec(preempt_count);
+        }
+
+        static inline bool in_interrupt(void) {
+                return this_cpu_read(irq_count) != 0;
+        }
+
+        static inline bool preemptible(void) {
+                return this_cpu_read(preempt_count) == 0 && !in_interrupt() && (read_eflags() & EFLAGS_INTERRUPT_ENABLE_FLAG_SET);
+        }
+
+#endif /** PREEMPT_H */
@@ -0,0 +1,46 @@
+#ifndef RCU_H
+        #define RCU_H
+
+        #include <stdbool.h>
+        #include <stdint.h>
+        #include <arch/cpu/cpu.h>
+        #include <kernel/preempt.h>
+
+        /*
+        * Quiescent state based RCU. Readers only mark their critical section (which disables preemption and costs no atomic
+        * operation), writers publish new versions with rcu_assign_pointer() and wait with synchronize_rcu() (or defer with call_rcu())
+        * until every online cpu went through a quiescent state before freeing the old version.
+        * Quiescent states are reported by the idle loop and by context switches, a cpu that is idle (halted) is in an extended
+        * quiescent state and never delays a grace period. Read side critical sections must not sleep nor enter the idle loop.
+        */
+
+        typedef struct rcu_head {
+                struct rcu_head *next;
+                void (*function)(struct rcu_head*);
+        } rcu_head_t;
+
+        #define rcu_assign_pointer(pointer, value) do { \
+                arch_compiler_barrier(); \
+                (pointer) = (value); \
+        } while (0)
+
+        #define rcu_dereference(pointer) (*(__typeof__(pointer) volatile*) &(pointer))
+
+        static inline void rcu_read_lock(void) {
+                preempt_disable();
+        }
+
+        static inline void rcu_read_unlock(void) {
+                preempt_enable();
+        }
+
+        void rcu_quiescent_state(void);
+        void rcu_idle_enter(void);
+        void rcu_idle_exit(void);
+        void rcu_irq_enter(void);
+        void rcu_irq_exit(void);
+        void synchronize_rcu(void);
+        void call_rcu(rcu_head_t*, void (*)(rcu_head_t*));
+        void rcu_process_callbacks(void);
+
+#endif /** RCU_H */
@@ -0,0 +1,55 @@
+#ifndef SCHED_H
+        #define SCHED_H
+
+        #include <stdbool.h>
+        #include <stddef.h>
+        #include <stdint.h>
+        #include <arch/cpu/percpu.h>
+        #include <kernel/spinlock.h>
+        #include <kernel/thread.h>
+
+        /*
+        * Number of timer ticks a thread runs before being preempted in favour of another runnable thread.
+        */
+
+        #define SCHED_TIMESLICE_TICKS 10
+
+        /*
+        * Per cpu run queue: one FIFO list of runnable threads per priority and a bitmap of the non empty lists, so the next
+        * thread to run is found with a single bit scan. nr_queued is read without the lock by the other cpus to balance load.
+        */
+
+        typedef struct runqueue {
+                spinlock_t lock;
+                uint32_t bitmap;
+                volatile uint32_t nr_queued;
+                thread_t *head[SCHED_PRIORITIES];
+                thread_t *tail[SCHED_PRIORITIES];
+        } runqueue_t;
+
+        DECLARE_PER_CPU(thread_t*, current_thread);
+
+        /*
+        * Thread running on this cpu, NULL before sched_init_cpu().
+        */
+
+        static inline thread_t* thread_current(void) {
+                return this_cpu_read(current_thread);
+        }
+
+        void sched_init(void);
+        void sched_init_cpu(void);
+        void schedule(void);
+        void schedule_tail(void);
+        void sched_enqueue(thread_t*);
+        void sched_wakeup(thread_t*);
+        void sched_set_state(uint32_t);
+        void preempt_check_resched(void);
+        void sched_join(thread_t*);
+        void sched_exit(void) __attribute__((noreturn));
+        bool sched_idle_should_run(void);
+        bool sched_cpu_idle(size_t);
+        void sched_tick(void);
+        void preempt_schedule_irq(uint32_t);
+
+#endif /** SCHED_H */
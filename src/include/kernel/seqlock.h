@@ -0,0 +1,80 @@
+#ifndef SEQLOCK_H
+        #define SEQLOCK_H
+
+        #include <stdbool.h>
+        #include <stdint.h>
+        #include <arch/cpu/cpu.h>
+        #include <kernel/spinlock.h>
+
+        /*
+        * Sequence counters for small read-mostly records. Writers make the sequence odd while they update the record,
+        * readers never write shared memory: they copy the record and retry if the sequence was odd or changed meanwhile.
+        * x86 does not reorder loads with loads nor stores with stores, so only compiler barriers are needed.
+        * A seqcount_t relies on its writers being serialized by some other lock, a seqlock_t carries its own.
+        * Readers must not run on a cpu interrupted in the middle of a write (they would spin forever): records also read
+        * from interrupt handlers must be written with interrupts disabled.
+        */
+
+        typedef struct seqcount {
+                volatile uint32_t sequence;
+        } seqcount_t;
+
+        typedef struct seqlock {
+                seqcount_t count;
+                spinlock_t lock;
+        } seqlock_t;
+
+        static inline uint32_t read_seqcount_begin(const seqcount_t *count) {
+                uint32_t sequence;
+                while ((sequence = count->sequence) & 1) {
+                        arch_pause();
+                }
+                arch_compiler_barrier();
+                return sequence;
+        }
+
+        static inline bool read_seqcount_retry(const seqcount_t *count, uint32_t sequence) {
+                arch_compiler_barrier();
+                return count->sequence != sequence;
+        }
+
+        static inline void write_seqcount_begin(seqcount_t *count) {
+                count->sequence++;
+                arch_compiler_barrier();
+        }
+
+        static inline void write_seqcount_end(seqcount_t *count) {
+                arch_compiler_barrier();
+                count->sequence++;
+        }
+
+        static inline uint32_t read_seqbegin(const seqlock_t *seqlock) {
+                return read_seqcount_begin(&seqlock->count);
+        }
+
+        static inline bool read_seqretry(const seqlock_t *seqlock, uint32_t sequence) {
+                return read_seqcount_retry(&seqlock->count, sequence);
+        }
+
+        static inline void write_seqlock(seqlock_t *seqlock) {
+                lock(&seqlock->lock);
+                write_seqcount_begin(&seqlock->count);
+        }
+
+        static inline void write_sequnlock(seqlock_t *seqlock) {
+                write_seqcount_end(&seqlock->count);
+                unlock(&seqlock->lock);
+        }
+
+        static inline uint32_t write_seqlock_irqsave(seqlock_t *seqlock) {
+                uint32_t eflags = lock_irqsave(&seqlock->lock);
+                write_seqcount_begin(&seqlock->count);
+                return eflags;
+        }
+
+        static inline void write_sequnlock_irqrestore(seqlock_t *seqlock, uint32_t eflags) {
+                write_seqcount_end(&seqlock->count);
+                unlock_irqrestore(&seqlock->lock, eflags);
+        }
+
+#endif /** SEQLOCK_H */
@@ -0,0 +1,56 @@
+#ifndef SOFTIRQ_H
+        #define SOFTIRQ_H
+
+        #include <stdbool.h>
+        #include <stdint.h>
+        #include <arch/cpu/percpu.h>
+
+        /*
+        * Softirqs are the deferred half of interrupt handlers: a handler raises one and returns, the work runs on the
+        * way out of the outermost interrupt, after the EOI and with interrupts enabled, on the cpu that raised it.
+        * A pass runs every pending softirq once, passes are repeated while new ones are raised but at most
+        * SOFTIRQ_MAX_RESTART times and for SOFTIRQ_BUDGET_NS: the rest is left to ksoftirqd, a per cpu thread scheduled like
+        * any other, so that a flood of interrupts cannot starve threads.
+        * Softirqs count as interrupt context (in_interrupt() is true) and must not sleep. Data they share with threads must
+        * be protected with lock_irqsave().
+        */
+
+        #define SOFTIRQ_TIMER 0
+        #define SOFTIRQ_TASKLET 1
+        #define SOFTIRQ_MAX 2
+
+        #define SOFTIRQ_MAX_RESTART 10
+        #define SOFTIRQ_BUDGET_NS 2000000ULL
+
+        /*
+        * A tasklet is a function run once from the tasklet softirq of the cpu that scheduled it. Scheduling a tasklet already
+        * scheduled does nothing, a tasklet never runs on two cpus at the same time but can be scheduled again while it runs.
+        */
+
+        #define TASKLET_STATE_SCHEDULED 0
+        #define TASKLET_STATE_RUNNING 1
+
+        typedef void (*softirq_handler_t)(void);
+        typedef void (*tasklet_func_t)(void*);
+
+        typedef struct tasklet {
+                struct tasklet *next;
+                volatile uint32_t state;
+                tasklet_func_t function;
+                void *arg;
+        } tasklet_t;
+
+        DECLARE_PER_CPU(uint32_t, softirq_pending);
+
+        static inline bool softirq_is_pending(void) {
+                return this_cpu_read(softirq_pending) != 0;
+        }
+
+        void softirq_init(void);
+        void raise_softirq(uint32_t);
+        void raise_softirq_irqoff(uint32_t);
+        void softirq_irq_exit(void);
+        void tasklet_init(tasklet_t*, tasklet_func_t, void*);
+        void tasklet_schedule(tasklet_t*);
+
+#endif /** SOFTIRQ_H */
@@ -5,12 +5,74 @@
         #include <stdint.h>
         #include <arch/cpu/cpu.h>
 
+        /*
+        * Ticket lock for short critical sections: the high half of lock is the next ticket to hand out,
+        * the low half is the ticket being served. A zero initialized lock is unlocked.
+        */
+
+        #define SPINLOCK_TICKET_SHIFT 16
+        #define SPINLOCK_OWNER_MASK 0xFFFF
+
+        /*
+        * Number of pause instructions a waiting cpu executes for every cpu ahead of it before checking the lock again.
+        */
+
+        #define SPINLOCK_BACKOFF_PAUSES 16
+
+        /*
+        * With LOCKSTAT the lock also carries its statistics registration and the time it was taken at (see kernel/lockstat.h).
+        */
+
         typedef struct spinlock {
         char name[8];
         volatile uint32_t lock;
+        #ifdef LOCKSTAT
+                uint32_t stat_id;
+                uint64_t acquired_tsc;
+        #endif
         } spinlock_t;
+
+        /*
+        * MCS queued lock for contended critical sections. Every waiter spins on its own node (which it provides and
+        * which must stay valid until the matching mcs_unlock()), so only one cache line changes hands on every release.
+        */
+
+        typedef struct mcs_node {
+                struct mcs_node *volatile next;
+                volatile uint32_t locked;
+        } mcs_node_t;
+
+        typedef struct mcs_lock {
+                char name[8];
+                mcs_node_t *volatile tail;
+        } mcs_lock_t;
         
+        /*
+        * Reader-writer spinlock with writer preference. state holds the number of readers, or RWLOCK_WRITER while a writer
+        * holds the lock. New readers do not enter while a writer is waiting, so writers cannot starve. For the same reason a
+        * cpu must not take the read side recursively. A zero initialized lock is unlocked.
+        */
+
+        #define RWLOCK_WRITER 0x80000000
+
+        typedef struct rwlock {
+                char name[8];
+                volatile uint32_t state;
+                volatile uint32_t writers_waiting;
+        } rwlock_t;
+
         void lock(spinlock_t *lock);
+        bool try_lock(spinlock_t *lock);
         void unlock(spinlock_t* lock);
+        uint32_t lock_irqsave(spinlock_t*);
+        void unlock_irqrestore(spinlock_t*, uint32_t);
+        void mcs_lock(mcs_lock_t*, mcs_node_t*);
+        void mcs_unlock(mcs_lock_t*, mcs_node_t*);
+        void read_lock(rwlock_t*);
+        void read_unlock(rwlock_t*);
+        void write_lock(rwlock_t*);
+        void write_unlock(rwlock_t*);
+        uint32_t write_lock_irqsave(rwlock_t*);
+        void write_unlock_irqrestore(rwlock_t*, uint32_t);
 
-#endif /** SPINLOCK_H */
\ No newline at end of file
+#endif /** SPINLOCK_H */
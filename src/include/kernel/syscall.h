@@ -0,0 +1,22 @@
+#ifndef SYSCALL_H
+        #define SYSCALL_H
+
+        /*
+        * System call numbers. The number goes in %eax and up to three arguments in %ebx, %esi and %edi, the result is
+        * returned in %eax (see arch/cpu/syscall.h for the entry convention).
+        */
+
+        #define SYS_EXIT 0
+        #define SYS_GETPID 1
+        #define SYSCALL_MAX 2
+
+        #ifndef __ASSEMBLER__
+                #include <stdint.h>
+
+                typedef uint32_t (*syscall_t)(uint32_t, uint32_t, uint32_t);
+
+                extern syscall_t syscall_table[SYSCALL_MAX];
+
+        #endif /** __ASSEMBLER__ */
+
+#endif /** SYSCALL_H */
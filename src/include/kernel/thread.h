@@ -0,0 +1,83 @@
+#ifndef THREAD_H
+        #define THREAD_H
+
+        #include <stdbool.h>
+        #include <stddef.h>
+        #include <stdint.h>
+        #include <arch/cpu/fpu.h>
+        #include <arch/cpu/syscall.h>
+        #include <kernel/spinlock.h>
+
+        #define THREAD_NAME_LENGTH 16
+
+        /*
+        * Every kernel thread gets KTHREAD_STACK_PAGES pages of stack preceded by an unmapped guard page, so that a stack
+        * overflow faults instead of silently corrupting memory. At most KTHREAD_MAX threads exist at the same time.
+        */
+
+        #define KTHREAD_STACK_PAGES 2
+        #define KTHREAD_MAX 256
+
+        #define THREAD_RUNNABLE 0
+        #define THREAD_BLOCKED 1
+        #define THREAD_DEAD 2
+
+        /*
+        * The idle thread of a cpu is the context the cpu booted on. It never blocks and is never queued.
+        */
+
+        #define THREAD_FLAG_IDLE 0x1
+
+        /*
+        * A pinned thread only ever runs on the cpu it was created on (see kthread_create_on_cpu()): it is neither stolen
+        * nor woken up elsewhere.
+        */
+
+        #define THREAD_FLAG_PINNED 0x2
+
+        typedef int (*thread_func_t)(void*);
+
+        /*
+        * Priorities go from 0 (highest) to SCHED_PRIORITIES - 1 (lowest). A thread only runs when no thread with a higher
+        * priority is runnable on its cpu, threads with the same priority share the cpu round robin.
+        */
+
+        #define SCHED_PRIORITIES 32
+        #define SCHED_PRIORITY_DEFAULT 16
+
+        /*
+        * Thread control block. It lives at the top of the thread stack. esp is the stack pointer saved by switch_context()
+        * while the thread is not running, on_cpu is true from the moment a cpu picks the thread until that cpu has switched
+        * away from it (its context is only valid after that). state, on_cpu and joiner are protected by lock, next by the
+        * lock of the run queue the thread is on. cpu is the cpu the thread last ran on. fpu is only touched by the cpu running
+        * the thread (see arch/cpu/fpu.h), user is saved and loaded by the scheduler (see arch/cpu/syscall.h).
+        */
+
+        typedef struct thread {
+                uint32_t esp;
+                uint32_t id;
+                spinlock_t lock;
+                volatile uint32_t state;
+                volatile bool on_cpu;
+                uint32_t flags;
+                uint32_t priority;
+                size_t cpu;
+                struct thread *next;
+                struct thread *joiner;
+                thread_func_t entry;
+                void *arg;
+                int exit_code;
+                size_t stack_slot;
+                char name[THREAD_NAME_LENGTH];
+                fpu_t fpu;
+                user_context_t user;
+        } thread_t;
+
+        thread_t* kthread_create(const char*, thread_func_t, void*);
+        thread_t* kthread_create_priority(const char*, thread_func_t, void*, uint32_t);
+        thread_t* kthread_create_on_cpu(const char*, thread_func_t, void*, uint32_t, size_t);
+        int kthread_join(thread_t*, int*);
+        void kthread_yield(void);
+        void kthread_exit(int) __attribute__((noreturn));
+
+#endif /** THREAD_H */
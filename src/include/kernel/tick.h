@@ -0,0 +1,37 @@
+#ifndef TICK_H
+        #define TICK_H
+
+        #include <stdbool.h>
+        #include <stdint.h>
+        #include <arch/cpu/percpu.h>
+        #include <kernel/clockevents.h>
+        #include <kernel/clocksource.h>
+
+        #define TICK_HZ 1000
+        #define TICK_NSEC (NSEC_PER_SEC / TICK_HZ)
+
+        /*
+        * Per cpu tick state. next_tick is the time of the next tick of a one shot tick, it keeps its period while the tick is
+        * stopped so that the tick restarts in phase. busy_ticks and idle_ticks count the ticks spent running threads and
+        * idling, including the ones skipped while the tick was stopped.
+        */
+
+        typedef struct tick_sched {
+                clock_event_device_t *device;
+                uint64_t next_tick;
+                uint64_t idle_entry;
+                uint64_t idle_sleeptime;
+                uint64_t busy_ticks;
+                uint64_t idle_ticks;
+                uint32_t stops;
+                bool stopped;
+        } tick_sched_t;
+
+        DECLARE_PER_CPU(tick_sched_t, tick_cpu_sched);
+
+        int tick_setup_device(clock_event_device_t*);
+        uint64_t get_jiffies(void);
+        void tick_nohz_idle_enter(void);
+        void tick_nohz_idle_exit(void);
+
+#endif /** TICK_H */
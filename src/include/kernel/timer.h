@@ -0,0 +1,67 @@
+#ifndef TIMER_H
+        #define TIMER_H
+
+        #include <stdbool.h>
+        #include <stddef.h>
+        #include <stdint.h>
+        #include <arch/cpu/percpu.h>
+        #include <kernel/spinlock.h>
+
+        /*
+        * Kernel timers have a resolution of one tick and are kept in a per cpu hierarchical timing wheel: the first level
+        * has one slot per tick for the next TIMER_ROOT_SLOTS ticks, every further level TIMER_LEVEL_SLOTS slots each
+        * covering a whole turn of the level below. Timers are cascaded one level down when the level below wraps around.
+        * Adding and cancelling a timer are O(1) and a tick only looks at one slot (plus a cascade every TIMER_ROOT_SLOTS ticks).
+        * Timers farther away than the wheel can hold expire at its horizon.
+        */
+
+        #define TIMER_ROOT_BITS 8
+        #define TIMER_LEVEL_BITS 6
+        #define TIMER_ROOT_SLOTS (1 << TIMER_ROOT_BITS)
+        #define TIMER_LEVEL_SLOTS (1 << TIMER_LEVEL_BITS)
+        #define TIMER_LEVELS 4
+        #define TIMER_ROOT_MASK (TIMER_ROOT_SLOTS - 1)
+        #define TIMER_LEVEL_MASK (TIMER_LEVEL_SLOTS - 1)
+        #define TIMER_MAX_TICKS ((1ULL << (TIMER_ROOT_BITS + (TIMER_LEVELS * TIMER_LEVEL_BITS))) - 1)
+        #define TIMER_NO_EXPIRY 0xFFFFFFFFFFFFFFFFULL
+
+        typedef void (*timer_func_t)(void*);
+
+        /*
+        * A timer is owned by its caller and is only touched by the wheel between timer_add() and its expiry or timer_cancel().
+        * base is the wheel it is queued on, NULL when it is not pending.
+        */
+
+        typedef struct timer {
+                struct timer *next;
+                struct timer **pprev;
+                struct timer_base *base;
+                uint64_t expires;
+                timer_func_t function;
+                void *arg;
+        } timer_t;
+
+        typedef struct timer_base {
+                spinlock_t lock;
+                uint64_t clk;
+                uint32_t pending;
+                timer_t *root[TIMER_ROOT_SLOTS];
+                timer_t *levels[TIMER_LEVELS][TIMER_LEVEL_SLOTS];
+        } timer_base_t;
+
+        DECLARE_PER_CPU(timer_base_t, timer_bases);
+
+        static inline bool timer_pending(const timer_t *timer) {
+                return *(struct timer_base* volatile*) &timer->base != NULL;
+        }
+
+        void timer_init_cpu(void);
+        int timer_add(timer_t*, uint64_t, timer_func_t, void*);
+        int timer_cancel(timer_t*);
+        void timer_run(uint64_t);
+        void timer_tick(uint64_t);
+        void timer_softirq(void);
+        uint64_t timer_next_expiry(void);
+        void timer_migrate_idle(void);
+
+#endif /** TIMER_H */
@@ -0,0 +1,130 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <arch/atomic.h>
+#include <arch/cpu/cpu.h>
+#include <arch/cpu/percpu.h>
+#include <arch/cpu/smp.h>
+#include <arch/cpu/smp_call.h>
+#include <kernel/bench.h>
+#include <kernel/printk.h>
+#include <kernel/spinlock.h>
+
+/*
+ * Lock contention microbenchmark: every online cpu acquires and releases the same lock LOCK_BENCH_ITERATIONS times
+ * around a tiny critical section. The old xchg test-and-set lock is kept here as a baseline.
+ * For every lock the cost of one acquisition (wall clock cycles / total acquisitions) and the spread between the first
+ * and the last cpu to finish are reported: a fair lock makes every cpu finish at about the same time.
+ * The time stamp counters of the cpus are assumed to be synchronized.
+ */
+
+#define LOCK_BENCH_ITERATIONS 10000
+
+#define LOCK_BENCH_TEST_AND_SET 0
+#define LOCK_BENCH_TICKET 1
+#define LOCK_BENCH_MCS 2
+#define LOCK_BENCH_LOCKS 3
+
+static const char *lock_bench_names[LOCK_BENCH_LOCKS] = {
+        "test-and-set",
+        "ticket",
+        "mcs",
+};
+
+static volatile uint32_t test_and_set_lock = 0;
+
+static spinlock_t ticket_lock = {
+        name: "bench",
+        lock: 0,
+};
+
+static mcs_lock_t queued_lock = {
+        name: "bench",
+        tail: NULL,
+};
+
+static atomic_t ready;
+static volatile uint32_t start;
+static atomic_t done;
+static volatile uint32_t counter;
+static uint64_t begin_tsc;
+static uint64_t end_tsc[MAX_CPUS];
+
+static void lock_bench_run(void *arg) {
+        uint32_t type = (uint32_t) arg;
+        mcs_node_t node;
+        atomic_inc(&ready);
+        while (!start) {
+                arch_pause();
+        }
+        for (size_t i = 0; i < LOCK_BENCH_ITERATIONS; i++) {
+                switch (type) {
+                        case LOCK_BENCH_TEST_AND_SET:
+                                while (arch_atomic_swap(1, &test_and_set_lock) != 0);
+                                counter++;
+                                test_and_set_lock = 0;
+                                break;
+                        case LOCK_BENCH_TICKET:
+                                lock(&ticket_lock);
+                                counter++;
+                                unlock(&ticket_lock);
+                                break;
+                        case LOCK_BENCH_MCS:
+                                mcs_lock(&queued_lock, &node);
+                                counter++;
+                                mcs_unlock(&queued_lock, &node);
+                                break;
+                }
+        }
+        end_tsc[this_cpu_read(cpu_index)] = read_tsc();
+        atomic_inc(&done);
+}
+
+/*
+ * The other cpus run the benchmark from the cross cpu call interrupt, the calling cpu joins once all of them are spinning on start.
+ */
+
+void lock_bench() {
+        size_t self = this_cpu_read(cpu_index);
+        cpumask_t others = cpu_online_mask;
+        cpumask_clear(&others, self);
+        uint32_t participants = cpumask_weight(&cpu_online_mask);
+        printk("[BENCH]: Lock contention, %d cpus, %d acquisitions per cpu.\n", participants, LOCK_BENCH_ITERATIONS);
+        for (uint32_t type = 0; type < LOCK_BENCH_LOCKS; type++) {
+                atomic_set(&ready, 0);
+                start = 0;
+                atomic_set(&done, 0);
+                counter = 0;
+                if (smp_call_function(&others, lock_bench_run, (void*) type, false)) {
+                        printk("[BENCH]: Failed to start the lock benchmark on the other cpus!\n");
+                        return;
+                }
+                while ((uint32_t) atomic_read(&ready) < participants - 1) {
+                        arch_pause();
+                }
+                begin_tsc = read_tsc();
+                start = 1;
+                lock_bench_run((void*) type);
+                while ((uint32_t) atomic_read(&done) < participants) {
+                        arch_pause();
+                }
+                uint64_t first = (uint64_t) -1;
+                uint64_t last = 0;
+                for (size_t i = 0; i < num_cpus; i++) {
+                        if (!cpumask_test(&cpu_online_mask, i)) {
+                                continue;
+                        }
+                        if (end_tsc[i] < first) {
+                                first = end_tsc[i];
+                        }
+                        if (end_tsc[i] > last) {
+                                last = end_tsc[i];
+                        }
+                }
+                uint64_t acquisitions = (uint64_t) participants * LOCK_BENCH_ITERATIONS;
+                printk("[BENCH]: %s: %ld cycles per acquisition, finish spread %ld cycles.\n", lock_bench_names[type], (last - begin_tsc) / acquisitions, last - first);
+                if (counter != acquisitions) {
+                        printk("[BENCH]: %s: mutual exclusion violated, counter is %d instead of %ld!\n", lock_bench_names[type], counter, acquisitions);
+                }
+        }
+}
@@ -0,0 +1,74 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <arch/cpu/cpu.h>
+#include <arch/cpu/syscall.h>
+#include <arch/kernel/mm/vm.h>
+#include <arch/mmu.h>
+#include <kernel/bench.h>
+#include <kernel/mm/pm.h>
+#include <kernel/printk.h>
+#include <kernel/syscall.h>
+#include <lib/string.h>
+
+/*
+ * Null system call microbenchmark: a user mode loop (syscall_bench_user_start in sysenter_low.S) issues SYS_GETPID
+ * SYSCALL_BENCH_ITERATIONS times through SYSENTER/SYSEXIT. The cost of a round trip is the whole run divided by the
+ * number of calls, the single entry to and exit from user mode is negligible. The cost of calling the system call
+ * function directly from the kernel is reported as the baseline.
+ */
+
+#define SYSCALL_BENCH_ITERATIONS 100000
+#define SYSCALL_BENCH_USER_CODE 0x40000000
+#define SYSCALL_BENCH_USER_STACK 0x40001000
+
+extern uint8_t syscall_bench_user_start[];
+extern uint8_t syscall_bench_user_end[];
+
+static int map_user_page(virt_addr_t address) {
+        phys_addr_t frame = get_free_frame();
+        if (frame == (phys_addr_t) -1) {
+                return -1;
+        }
+        if (map_page(frame, address, PROT_PRESENT | PROT_READ_WRITE | PROT_USER, false)) {
+                free_frame(frame);
+                return -1;
+        }
+        return 0;
+}
+
+void syscall_bench() {
+        if (!sysenter) {
+                printk("[BENCH]: SYSENTER not supported, skipping the system call benchmark.\n");
+                return;
+        }
+        if (map_user_page(SYSCALL_BENCH_USER_CODE)) {
+                printk("[BENCH]: Failed to map the system call benchmark pages!\n");
+                return;
+        }
+        if (map_user_page(SYSCALL_BENCH_USER_STACK)) {
+                unmap_page(SYSCALL_BENCH_USER_CODE);
+                printk("[BENCH]: Failed to map the system call benchmark pages!\n");
+                return;
+        }
+        memcpy((void*) SYSCALL_BENCH_USER_CODE, syscall_bench_user_start, syscall_bench_user_end - syscall_bench_user_start);
+        uint32_t *user_stack = (uint32_t*) (SYSCALL_BENCH_USER_STACK + PAGE_SIZE) - 1;
+        *user_stack = SYSCALL_BENCH_ITERATIONS;
+        uint32_t eflags = arch_irq_save();
+        uint64_t start = read_tsc();
+        int code = arch_enter_user(SYSCALL_BENCH_USER_CODE, (uint32_t) user_stack);
+        uint64_t syscall_cycles = read_tsc() - start;
+        syscall_t volatile getpid = syscall_table[SYS_GETPID];
+        start = read_tsc();
+        for (uint32_t i = 0; i < SYSCALL_BENCH_ITERATIONS; i++) {
+                getpid(0, 0, 0);
+        }
+        uint64_t call_cycles = read_tsc() - start;
+        arch_irq_restore(eflags);
+        unmap_page(SYSCALL_BENCH_USER_STACK);
+        unmap_page(SYSCALL_BENCH_USER_CODE);
+        if (code != 0) {
+                printk("[BENCH]: System call benchmark exited with code %d!\n", code);
+                return;
+        }
+        printk("[BENCH]: Null system call (SYSENTER/SYSEXIT): %ld cycles per round trip, direct call: %ld cycles, %d calls.\n", syscall_cycles / SYSCALL_BENCH_ITERATIONS, call_cycles / SYSCALL_BENCH_ITERATIONS, SYSCALL_BENCH_ITERATIONS);
+}
@@ -0,0 +1,39 @@
+#include <stdbool.h>
+#include <arch/cpu/cpu.h>
+#include <kernel/idle.h>
+#include <kernel/rcu.h>
+#include <kernel/sched.h>
+#include <kernel/tick.h>
+
+/*
+ * Halts the cpu until the next interrupt unless the scheduler has work for it. The cpu is in an RCU extended quiescent state
+ * and its tick is stopped while halted. Interrupts are only enabled by the sti right before hlt, so no wakeup can be lost in between.
+ * Returns with interrupts enabled.
+ */
+
+void idle_wait() {
+        arch_cli();
+        if (sched_idle_should_run()) {
+                arch_sti();
+                return;
+        }
+        tick_nohz_idle_enter();
+        rcu_idle_enter();
+        arch_sti_halt();
+        rcu_idle_exit();
+        tick_nohz_idle_exit();
+}
+
+/*
+ * Idle loop of every cpu once it has nothing else to do. Runs as the idle thread of the cpu (see sched_init_cpu()).
+ */
+
+void cpu_idle() {
+        while (true) {
+                rcu_process_callbacks();
+                if (sched_idle_should_run()) {
+                        schedule();
+                }
+                idle_wait();
+        }
+}
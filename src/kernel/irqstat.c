@@ -0,0 +1,127 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <arch/cpu/cpu.h>
+#include <arch/cpu/percpu.h>
+#include <arch/cpu/smp.h>
+#include <kernel/irqstat.h>
+#include <kernel/printk.h>
+#include <lib/string.h>
+
+/*
+ * printk() has no field width, the dump lines are formatted here in columns of IRQSTAT_COLUMN_WIDTH characters (enough
+ * for any 32 bit value and a separating space) and printed with a single call each, so they do not interleave.
+ * A line has at most one column per cpu plus the vector column, histogram lines are shorter.
+ */
+
+#define IRQSTAT_COLUMN_WIDTH 11
+#define IRQSTAT_LINE_LENGTH (((MAX_CPUS + 1) * IRQSTAT_COLUMN_WIDTH) + 1)
+
+DEFINE_PER_CPU(uint32_t[IRQSTAT_VECTORS], irqstat_counts);
+
+#ifdef IRQSTAT
+        DEFINE_PER_CPU(uint32_t[IRQSTAT_VECTORS][IRQSTAT_HISTOGRAM_BUCKETS], irqstat_histograms);
+
+        /*
+        * Called by the interrupt dispatcher with interrupts disabled once the interrupt is acknowledged.
+        */
+
+        void irqstat_latency(uint8_t vector, uint64_t cycles) {
+                if (this_cpu_offset_read() == 0) {
+                        return;
+                }
+                uint64_t scaled = cycles >> IRQSTAT_HISTOGRAM_SHIFT;
+                size_t bucket = scaled == 0 ? 0 : (size_t) (64 - __builtin_clzll(scaled));
+                if (bucket >= IRQSTAT_HISTOGRAM_BUCKETS) {
+                        bucket = IRQSTAT_HISTOGRAM_BUCKETS - 1;
+                }
+                (*this_cpu_ptr(irqstat_histograms))[vector][bucket]++;
+        }
+#endif
+
+/*
+ * Appends text to line right aligned in a column. Returns the new length of line.
+ */
+
+static size_t append_text(char *line, size_t length, const char *text) {
+        size_t text_length = strlen(text);
+        for (size_t i = text_length; i < IRQSTAT_COLUMN_WIDTH; i++) {
+                line[length++] = ' ';
+        }
+        memcpy(&line[length], text, text_length + 1);
+        return length + text_length;
+}
+
+static size_t append_column(char *line, size_t length, const char *prefix, uint32_t value) {
+        char text[IRQSTAT_COLUMN_WIDTH + 1];
+        char digits[10];
+        size_t count = 0;
+        do {
+                digits[count++] = (char) ('0' + (value % 10));
+                value /= 10;
+        } while (value);
+        size_t text_length = strlen(prefix);
+        memcpy(text, prefix, text_length);
+        while (count) {
+                text[text_length++] = digits[--count];
+        }
+        text[text_length] = '\0';
+        return append_text(line, length, text);
+}
+
+/*
+ * Prints the counters of every vector raised at least once, one column per cpu like /proc/interrupts, and with IRQSTAT=1
+ * the latency histograms of the interrupt vectors summed over all cpus. The counters of the other cpus are read without
+ * stopping them, so the figures of vectors being raised meanwhile may be slightly off.
+ */
+
+void irqstat_dump() {
+        char line[IRQSTAT_LINE_LENGTH];
+        size_t length = append_text(line, 0, "vector");
+        for (size_t i = 0; i < num_cpus; i++) {
+                length = append_column(line, length, "CPU", (uint32_t) i);
+        }
+        printk("[IRQSTAT]: %s\n", line);
+        for (size_t vector = 0; vector < IRQSTAT_VECTORS; vector++) {
+                bool raised = false;
+                length = append_column(line, 0, "", (uint32_t) vector);
+                for (size_t i = 0; i < num_cpus; i++) {
+                        uint32_t count = per_cpu_offset[i] == 0 ? 0 : (*per_cpu_ptr(irqstat_counts, i))[vector];
+                        raised |= count != 0;
+                        length = append_column(line, length, "", count);
+                }
+                if (raised) {
+                        printk("[IRQSTAT]: %s\n", line);
+                }
+        }
+        #ifdef IRQSTAT
+                length = append_text(line, 0, "cycles");
+                for (size_t bucket = 0; bucket < IRQSTAT_HISTOGRAM_BUCKETS - 1; bucket++) {
+                        length = append_column(line, length, "<", 1U << (IRQSTAT_HISTOGRAM_SHIFT + bucket));
+                }
+                length = append_column(line, length, ">=", 1U << (IRQSTAT_HISTOGRAM_SHIFT + IRQSTAT_HISTOGRAM_BUCKETS - 2));
+                printk("[IRQSTAT]: %s\n", line);
+                for (size_t vector = 0; vector < IRQSTAT_VECTORS; vector++) {
+                        uint32_t histogram[IRQSTAT_HISTOGRAM_BUCKETS];
+                        memset(histogram, 0x0, sizeof(histogram));
+                        bool raised = false;
+                        for (size_t i = 0; i < num_cpus; i++) {
+                                if (per_cpu_offset[i] == 0) {
+                                        continue;
+                                }
+                                for (size_t bucket = 0; bucket < IRQSTAT_HISTOGRAM_BUCKETS; bucket++) {
+                                        histogram[bucket] += (*per_cpu_ptr(irqstat_histograms, i))[vector][bucket];
+                                        raised |= histogram[bucket] != 0;
+                                }
+                        }
+                        if (!raised) {
+                                continue;
+                        }
+                        length = append_column(line, 0, "", (uint32_t) vector);
+                        for (size_t bucket = 0; bucket < IRQSTAT_HISTOGRAM_BUCKETS; bucket++) {
+                                length = append_column(line, length, "", histogram[bucket]);
+                        }
+                        printk("[IRQSTAT]: %s\n", line);
+                }
+        #endif
+}
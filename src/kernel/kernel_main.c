@@ -1,15 +1,48 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <arch/cpu/cpu.h>
+#include <kernel/bench.h>
 #include <kernel/bootinfo.h>
+#include <kernel/idle.h>
+#include <kernel/irqstat.h>
+#include <kernel/lockstat.h>
 #include <kernel/printk.h>
+#include <kernel/sched.h>
+#include <kernel/softirq.h>
+#include <kernel/thread.h>
 #include <kernel/mm/kmalloc.h>
 
+#define TEST_THREADS 4
+
+static int test_thread(void *arg) {
+	printk("[KERNEL]: Thread %d running on cpu %d.\n", (size_t) arg, this_cpu_read(cpu_index));
+	kthread_yield();
+	return (int) (size_t) arg;
+}
+
 void kernel_main(bootinfo_t *boot_info) {
 	printk("[KERNEL]: Arch init complete.\n[KERNEL]: Command line: \"%s\"\n", boot_info->command_line);
 	if (k_malloc_init()) {
 		panic("[KERNEL]: Failed to initialize heap! File: %s line: %d function: %s\n", __FILENAME__, __LINE__, __func__);
 	}
+	sched_init();
+	softirq_init();
+	#ifdef BENCH
+		lock_bench();
+		syscall_bench();
+	#endif
+	thread_t *threads[TEST_THREADS];
+	for (size_t i = 0; i < TEST_THREADS; i++) {
+		threads[i] = kthread_create("test", test_thread, (void*) i);
+		if (!threads[i]) {
+			panic("[KERNEL]: Failed to create kernel thread! File: %s line: %d function: %s\n", __FILENAME__, __LINE__, __func__);
+		}
+	}
+	for (size_t i = 0; i < TEST_THREADS; i++) {
+		int exit_code;
+		kthread_join(threads[i], &exit_code);
+		printk("[KERNEL]: Thread %d exited with code %d.\n", i, exit_code);
+	}
 	for(;;) {
 		size_t count = 0;
 		uint32_t *p = (uint32_t*) k_malloc(sizeof(uint32_t));
@@ -24,7 +57,9 @@ void kernel_main(bootinfo_t *boot_info) {
 			break;
 		}
 	}
-	while(1) {
-		arch_halt();
-	}
+	irqstat_dump();
+	#ifdef LOCKSTAT
+		lockstat_dump();
+	#endif
+	cpu_idle();
 }
\ No newline at end of file
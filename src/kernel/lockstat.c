@@ -0,0 +1,134 @@
+#ifdef LOCKSTAT
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <arch/cpu/cpu.h>
+#include <arch/cpu/percpu.h>
+#include <arch/cpu/smp.h>
+#include <kernel/lockstat.h>
+#include <kernel/printk.h>
+#include <kernel/spinlock.h>
+#include <lib/string.h>
+
+/*
+ * Registered locks, the stat_id of a lock is its index here plus one (0 means not registered yet, LOCKSTAT_UNTRACKED
+ * that the table was full when it was first taken). Only the holder of a lock touches its stat_id and acquired_tsc
+ * fields so they need no synchronization.
+ */
+
+#define LOCKSTAT_UNTRACKED 0xFFFFFFFF
+
+static spinlock_t *lockstat_locks[LOCKSTAT_MAX_LOCKS];
+static volatile uint32_t lockstat_next_id = 0;
+
+DEFINE_PER_CPU(lockstat_t[LOCKSTAT_MAX_LOCKS], lockstat);
+
+/*
+ * Returns the counters of lock for the running cpu or NULL if it cannot be tracked. Acquisitions made before the per cpu
+ * areas are set up are not recorded: until then the %gs segment of the cpu addresses the per cpu template.
+ */
+
+static lockstat_t* lockstat_get(spinlock_t *lock) {
+        if (this_cpu_offset_read() == 0) {
+                return NULL;
+        }
+        if (lock->stat_id == LOCKSTAT_UNTRACKED) {
+                return NULL;
+        }
+        if (lock->stat_id == 0) {
+
+                // Only claim an id while there is one left, so that lockstat_next_id never moves past the table.
+
+                uint32_t id = lockstat_next_id;
+                while (id < LOCKSTAT_MAX_LOCKS) {
+                        uint32_t seen = arch_atomic_compare_exchange(id, id + 1, &lockstat_next_id);
+                        if (seen == id) {
+                                break;
+                        }
+                        id = seen;
+                }
+                if (id >= LOCKSTAT_MAX_LOCKS) {
+                        lock->stat_id = LOCKSTAT_UNTRACKED;
+                        return NULL;
+                }
+                lockstat_locks[id] = lock;
+                lock->stat_id = id + 1;
+        }
+        return &(*this_cpu_ptr(lockstat))[lock->stat_id - 1];
+}
+
+/*
+ * Called by the holder right after taking the lock. spin_cycles is the time spent waiting for it.
+ */
+
+void lockstat_acquired(spinlock_t *lock, bool contended, uint64_t spin_cycles) {
+        lockstat_t *stat = lockstat_get(lock);
+        if (!stat) {
+                return;
+        }
+        stat->acquisitions++;
+        if (contended) {
+                stat->contended++;
+        }
+        stat->spin_cycles += spin_cycles;
+        if (spin_cycles > stat->spin_cycles_max) {
+                stat->spin_cycles_max = spin_cycles;
+        }
+        lock->acquired_tsc = read_tsc();
+}
+
+/*
+ * Called by the holder right before releasing the lock.
+ */
+
+void lockstat_released(spinlock_t *lock) {
+        if (lock->stat_id == 0 || lock->stat_id == LOCKSTAT_UNTRACKED || this_cpu_offset_read() == 0) {
+                return;
+        }
+        lockstat_t *stat = &(*this_cpu_ptr(lockstat))[lock->stat_id - 1];
+        uint64_t hold_cycles = read_tsc() - lock->acquired_tsc;
+        stat->hold_cycles += hold_cycles;
+        if (hold_cycles > stat->hold_cycles_max) {
+                stat->hold_cycles_max = hold_cycles;
+        }
+}
+
+/*
+ * Prints the counters of every registered lock summed over all cpus. The counters of the other cpus are read
+ * without stopping them, so the figures of locks being taken meanwhile may be slightly off.
+ */
+
+void lockstat_dump() {
+        uint32_t registered = lockstat_next_id;
+        printk("[LOCKSTAT]: name acquisitions contended spin total/max hold total/max (cycles)\n");
+        for (uint32_t id = 0; id < registered; id++) {
+                if (!lockstat_locks[id]) {
+                        continue;
+                }
+                lockstat_t total;
+                memset(&total, 0x0, sizeof(lockstat_t));
+                for (size_t i = 0; i < num_cpus; i++) {
+                        if (per_cpu_offset[i] == 0) {
+                                continue;
+                        }
+                        lockstat_t *stat = &(*per_cpu_ptr(lockstat, i))[id];
+                        total.acquisitions += stat->acquisitions;
+                        total.contended += stat->contended;
+                        total.spin_cycles += stat->spin_cycles;
+                        total.hold_cycles += stat->hold_cycles;
+                        if (stat->spin_cycles_max > total.spin_cycles_max) {
+                                total.spin_cycles_max = stat->spin_cycles_max;
+                        }
+                        if (stat->hold_cycles_max > total.hold_cycles_max) {
+                                total.hold_cycles_max = stat->hold_cycles_max;
+                        }
+                }
+                char name[sizeof(lockstat_locks[id]->name) + 1];
+                memcpy(name, lockstat_locks[id]->name, sizeof(lockstat_locks[id]->name));
+                name[sizeof(lockstat_locks[id]->name)] = '\0';
+                printk("[LOCKSTAT]: %s %ld %ld %ld/%ld %ld/%ld\n", name, total.acquisitions, total.contended, total.spin_cycles, total.spin_cycles_max, total.hold_cycles, total.hold_cycles_max);
+        }
+}
+
+#endif /** LOCKSTAT */
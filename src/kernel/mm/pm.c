@@ -11,6 +11,7 @@
 #include <kernel/bootinfo.h>
 #include <kernel/bootmem.h>
 #include <kernel/printk.h>
+#include <kernel/seqlock.h>
 #include <kernel/spinlock.h>
 #include <lib/bitmap.h>
 #include <lib/string.h>
@@ -22,11 +23,19 @@ static bitmap_list_t *bitmap_list = NULL;
 static size_t total_blocks = 0;
 static size_t total_reserved_blocks = 0;
 static size_t total_used_blocks = 0;
+
+// This is used to remember the last bitmap with free blocks. Initially it is the first bitmap.
+
+static bitmap_list_t *last_with_free_blocks = NULL;
 spinlock_t pmm_lock = {
         name: "pmm",
 	lock: 0,
 };
 
+// Lets pm_get_stats() read the counters without taking pmm_lock. Writers are serialized by pmm_lock.
+
+static seqcount_t pmm_stats_sequence;
+
 #ifdef DEBUG
 
 	/*
@@ -294,9 +303,7 @@ void pmm_init(bootinfo_t *boot_info) {
 	}
 
 	/*
-	 * If the systems supports SMP reserve a region of memory for its bootstrap code.
-	 * Note: the smp trampoline code uses 12 bytes from the 0th page for parameters but the 0th page should be already reserved as it contains 
-	 * real mode IVT and BDA.
+	 * If the systems supports SMP reserve a region of memory for its bootstrap code (0x1000) and its parameters (0x2000).
 	 */
 
 	if (smp) {
@@ -329,17 +336,11 @@ void pmm_init(bootinfo_t *boot_info) {
 	printk("[KERNEL]: Initialized physical memory\n[KERNEL]: Block size: %d bytes\n[KERNEL]: Total blocks: %d\n[KERNEL]: Reserved blocks: %d\n[KERNEL]: Used blocks: %d\n[KERNEL]: Total usable memory: %dMb\n[KERNEL]: Total available memory: %dMb\n", BLOCK_SIZE, total_blocks, total_reserved_blocks, total_used_blocks, (total_blocks - total_reserved_blocks) * BLOCK_SIZE / (1024 * 1024), boot_info->memory_size / (1024 * 1024));
 }
 
-/* 
- * These routines are exported to the upper kernel layers and implement the interface at <kernel/pm.h>
+/*
+ * Allocates a single block. Must be called with pmm_lock held.
  */
 
-phys_addr_t get_free_frame() {
-	
-	// This is used to remember the last bitmap with free blocks. Initially it is the first bitmap.
-	
-	lock(&pmm_lock);
-	static bitmap_list_t *last_with_free_blocks = NULL;
-	unlock(&pmm_lock);
+static phys_addr_t alloc_block() {
 	
 	// Check to see if there is any free block in the system.
 	
@@ -358,7 +359,6 @@ phys_addr_t get_free_frame() {
 		// Check if this bitmap has any free blocks.
 		
 		if (curr->total_blocks - curr->used_blocks > 0) {
-			lock(&pmm_lock);
 			int index = bitmap_first_unset(curr->bitmap, curr->total_blocks);
 			if (index != -1) {
         		bitmap_set(curr->bitmap, index);
@@ -370,10 +370,8 @@ phys_addr_t get_free_frame() {
 				if (curr->used_blocks == curr->total_blocks) {
 					last_with_free_blocks = curr->next;
 				}
-				unlock(&pmm_lock);
 				return (phys_addr_t) (BLOCK_SIZE * index) + curr->first_addr;
 			}
-			unlock(&pmm_lock);
 		}
 		if (curr->next == NULL || curr->next == bitmap_list) {
 			break;
@@ -383,7 +381,11 @@ phys_addr_t get_free_frame() {
 	return -1;
 }
 
-void free_frame(phys_addr_t addr) {
+/*
+ * Frees a single block. Must be called with pmm_lock held.
+ */
+
+static void release_block(phys_addr_t addr) {
 	bitmap_list_t *bitmap = addr_to_bitmap(addr);
 	if (bitmap == NULL) {
 		panic("[PM]: Could not find address to free! File: %s line: %d function: %s\n", __FILENAME__, __LINE__, __func__);
@@ -392,9 +394,73 @@ void free_frame(phys_addr_t addr) {
 	if (!bitmap_test(bitmap->bitmap, index)) {
 		panic("[PM]: Trying to free a block already free! File: %s line: %d function: %s\n", __FILENAME__, __LINE__, __func__);
 	}
-	lock(&pmm_lock);
 	bitmap_unset(bitmap->bitmap, index);
 	bitmap->used_blocks--;
 	total_used_blocks--;
+}
+
+/* 
+ * These routines are exported to the upper kernel layers and implement the interface at <kernel/pm.h>
+ */
+
+phys_addr_t get_free_frame() {
+	lock(&pmm_lock);
+	write_seqcount_begin(&pmm_stats_sequence);
+	phys_addr_t frame = alloc_block();
+	write_seqcount_end(&pmm_stats_sequence);
 	unlock(&pmm_lock);
+	return frame;
+}
+
+/*
+ * Batched variant of get_free_frame(): allocates up to count frames taking pmm_lock only once.
+ * Returns the number of frames stored in frames, which is less than count if memory ran out.
+ */
+
+size_t get_free_frames(phys_addr_t *frames, size_t count) {
+	size_t allocated = 0;
+	lock(&pmm_lock);
+	write_seqcount_begin(&pmm_stats_sequence);
+	while (allocated < count) {
+		phys_addr_t frame = alloc_block();
+		if (frame == (phys_addr_t) -1) {
+			break;
+		}
+		frames[allocated++] = frame;
+	}
+	write_seqcount_end(&pmm_stats_sequence);
+	unlock(&pmm_lock);
+	return allocated;
+}
+
+void free_frame(phys_addr_t addr) {
+	lock(&pmm_lock);
+	write_seqcount_begin(&pmm_stats_sequence);
+	release_block(addr);
+	write_seqcount_end(&pmm_stats_sequence);
+	unlock(&pmm_lock);
+}
+
+/*
+ * Batched variant of free_frame(): frees count frames taking pmm_lock only once.
+ */
+
+void free_frames(phys_addr_t *frames, size_t count) {
+	lock(&pmm_lock);
+	write_seqcount_begin(&pmm_stats_sequence);
+	for (size_t i = 0; i < count; i++) {
+		release_block(frames[i]);
+	}
+	write_seqcount_end(&pmm_stats_sequence);
+	unlock(&pmm_lock);
+}
+
+void pm_get_stats(pm_stats_t *stats) {
+	uint32_t sequence;
+	do {
+		sequence = read_seqcount_begin(&pmm_stats_sequence);
+		stats->total_blocks = total_blocks;
+		stats->reserved_blocks = total_reserved_blocks;
+		stats->used_blocks = total_used_blocks;
+	} while (read_seqcount_retry(&pmm_stats_sequence, sequence));
 }
\ No newline at end of file
@@ -258,7 +258,10 @@ static void print_hex_64(uint64_t value) {
  */
 
 void _printk(bool panic, const char* restrict format, ...) {
-	lock(&console_lock);
+
+	// Interrupt handlers print too: an interrupt taken while holding the console lock must not try to take it again.
+
+	uint32_t eflags = lock_irqsave(&console_lock);
 	va_list parameters;
 	va_start(parameters, format);
 	
@@ -364,5 +367,5 @@ void _printk(bool panic, const char* restrict format, ...) {
 		unlock(&console_lock);
 		arch_halt();
 	}
-	unlock(&console_lock);
+	unlock_irqrestore(&console_lock, eflags);
 }
\ No newline at end of file
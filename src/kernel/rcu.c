@@ -0,0 +1,162 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <arch/cpu/cpu.h>
+#include <arch/cpu/percpu.h>
+#include <arch/cpu/smp.h>
+#include <kernel/preempt.h>
+#include <kernel/rcu.h>
+#include <kernel/spinlock.h>
+
+/*
+ * rcu_gp_sequence is the number of the last grace period started, rcu_gp_completed the number of the last one completed.
+ * Every cpu records in rcu_qs_sequence the last grace period it reported a quiescent state for.
+ * rcu_dynticks is even while the cpu is idle and odd otherwise (interrupts taken while idle make it odd for their duration),
+ * it is changed with locked instructions so that the grace period side sees it in order with the surrounding accesses.
+ */
+
+static volatile uint32_t rcu_gp_sequence = 0;
+static volatile uint32_t rcu_gp_completed = 0;
+
+static spinlock_t rcu_gp_lock = {
+        name: "rcu",
+        lock: 0,
+};
+
+DEFINE_PER_CPU(uint32_t, rcu_qs_sequence);
+DEFINE_PER_CPU(uint32_t, rcu_dynticks) = 1;
+DEFINE_PER_CPU(bool, rcu_irq_from_idle);
+
+/*
+ * Callbacks queued by call_rcu() on this cpu, run by rcu_process_callbacks() after a grace period.
+ */
+
+DEFINE_PER_CPU(rcu_head_t*, rcu_callbacks);
+DEFINE_PER_CPU(rcu_head_t**, rcu_callbacks_tail);
+
+/*
+ * Must only be called outside of read side critical sections.
+ */
+
+void rcu_quiescent_state() {
+        arch_compiler_barrier();
+        this_cpu_write(rcu_qs_sequence, rcu_gp_sequence);
+}
+
+void rcu_idle_enter() {
+        rcu_quiescent_state();
+        arch_atomic_fetch_add(1, this_cpu_ptr(rcu_dynticks));
+}
+
+void rcu_idle_exit() {
+        arch_atomic_fetch_add(1, this_cpu_ptr(rcu_dynticks));
+}
+
+/*
+ * Interrupt handlers may have read side critical sections, so an interrupt taken while idle leaves the extended quiescent state.
+ * Interrupts nest while softirqs run, only the outermost one (irq_count is 1, raised by the caller) enters and leaves it.
+ */
+
+void rcu_irq_enter() {
+        if (this_cpu_read(irq_count) == 1 && !(this_cpu_read(rcu_dynticks) & 1)) {
+                arch_atomic_fetch_add(1, this_cpu_ptr(rcu_dynticks));
+                this_cpu_write(rcu_irq_from_idle, true);
+        }
+}
+
+void rcu_irq_exit() {
+        if (this_cpu_read(irq_count) == 1 && this_cpu_read(rcu_irq_from_idle)) {
+                this_cpu_write(rcu_irq_from_idle, false);
+                arch_atomic_fetch_add(1, this_cpu_ptr(rcu_dynticks));
+        }
+}
+
+/*
+ * A cpu went through a quiescent state since the grace period started if it reported one for it, if it was idle when the
+ * grace period started or if it entered the idle loop since then (its dynticks counter changed).
+ */
+
+static bool rcu_cpu_quiescent(size_t index, uint32_t sequence, uint32_t dynticks_snapshot) {
+        if ((int32_t) (*per_cpu_ptr(rcu_qs_sequence, index) - sequence) >= 0) {
+                return true;
+        }
+        uint32_t dynticks = *(volatile uint32_t*) per_cpu_ptr(rcu_dynticks, index);
+        return !(dynticks_snapshot & 1) || dynticks != dynticks_snapshot;
+}
+
+/*
+ * Waits until every read side critical section in progress on the other cpus is over. Grace periods are serialized, a caller
+ * finding that a grace period started after its call completed in the meantime returns without starting another one.
+ * Must be called with interrupts enabled and outside of read side critical sections.
+ */
+
+void synchronize_rcu() {
+        uint32_t entry_sequence = rcu_gp_sequence;
+        rcu_quiescent_state();
+
+        // Keep reporting quiescent states while waiting, the grace period in progress might be waiting for this cpu.
+
+        while (!try_lock(&rcu_gp_lock)) {
+                rcu_quiescent_state();
+                arch_pause();
+        }
+        if ((int32_t) (rcu_gp_completed - (entry_sequence + 1)) >= 0) {
+                unlock(&rcu_gp_lock);
+                return;
+        }
+        uint32_t sequence = arch_atomic_fetch_add(1, &rcu_gp_sequence) + 1;
+        rcu_quiescent_state();
+        size_t self = this_cpu_read(cpu_index);
+        uint32_t dynticks_snapshot[MAX_CPUS];
+        for (size_t i = 0; i < num_cpus; i++) {
+                dynticks_snapshot[i] = *(volatile uint32_t*) per_cpu_ptr(rcu_dynticks, i);
+        }
+        for (size_t i = 0; i < num_cpus; i++) {
+                if (i == self || !cpumask_test(&cpu_online_mask, i)) {
+                        continue;
+                }
+                while (!rcu_cpu_quiescent(i, sequence, dynticks_snapshot[i])) {
+                        arch_pause();
+                }
+        }
+        rcu_gp_completed = sequence;
+        unlock(&rcu_gp_lock);
+}
+
+/*
+ * Queues function(head) to be run on this cpu once a grace period elapsed. Can be called from interrupt handlers.
+ */
+
+void call_rcu(rcu_head_t *head, void (*function)(rcu_head_t*)) {
+        head->next = NULL;
+        head->function = function;
+        uint32_t eflags = arch_irq_save();
+        rcu_head_t **tail = this_cpu_read(rcu_callbacks_tail);
+        if (tail == NULL) {
+                tail = this_cpu_ptr(rcu_callbacks);
+        }
+        *tail = head;
+        this_cpu_write(rcu_callbacks_tail, &head->next);
+        arch_irq_restore(eflags);
+}
+
+/*
+ * Runs the callbacks queued on this cpu after waiting for a grace period. Called from the idle loop.
+ */
+
+void rcu_process_callbacks() {
+        uint32_t eflags = arch_irq_save();
+        rcu_head_t *list = this_cpu_read(rcu_callbacks);
+        this_cpu_write(rcu_callbacks, NULL);
+        this_cpu_write(rcu_callbacks_tail, NULL);
+        arch_irq_restore(eflags);
+        if (list == NULL) {
+                return;
+        }
+        synchronize_rcu();
+        while (list) {
+                rcu_head_t *next = list->next;
+                list->function(list);
+                list = next;
+        }
+}
@@ -0,0 +1,584 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <arch/cpu/cpu.h>
+#include <arch/cpu/fpu.h>
+#include <arch/cpu/percpu.h>
+#include <arch/cpu/smp.h>
+#include <arch/cpu/smp_call.h>
+#include <arch/cpu/switch.h>
+#include <arch/cpu/topology.h>
+#include <kernel/assert.h>
+#include <kernel/idle.h>
+#include <kernel/interrupt.h>
+#include <kernel/preempt.h>
+#include <kernel/printk.h>
+#include <kernel/rcu.h>
+#include <kernel/sched.h>
+#include <kernel/spinlock.h>
+#include <lib/string.h>
+
+/*
+ * Every cpu schedules the threads of its own run queue. A thread is only queued while it is runnable and off cpu: a thread
+ * preempted, yielding or woken up while it is still on a cpu is queued by that cpu once it switched away from it (see
+ * schedule_tail()), so no cpu can pick a thread whose context is still being saved.
+ * Woken up threads go back to the cpu they last ran on unless it is busy and an idle cpu shares a cache with it, new threads
+ * go to the least loaded cpu and a cpu running out of work steals from the busiest cpu of the closest cache domain.
+ * Pinned threads never leave their cpu.
+ * Lock ordering: a thread lock comes before a run queue lock and a cpu never holds two run queue locks at once.
+ * The run queue lock of the running cpu is taken by schedule() before the switch and released by the thread switched to.
+ */
+
+DEFINE_PER_CPU(runqueue_t, runqueue) = {
+        lock: {
+                name: "runq",
+                lock: 0,
+        },
+};
+
+DEFINE_PER_CPU(thread_t*, current_thread);
+DEFINE_PER_CPU(thread_t, idle_thread);
+DEFINE_PER_CPU(thread_t*, switch_prev);
+DEFINE_PER_CPU(bool, need_resched);
+DEFINE_PER_CPU(uint32_t, timeslice);
+
+static inline bool is_idle(thread_t *thread) {
+        return thread->flags & THREAD_FLAG_IDLE;
+}
+
+static inline thread_t* cpu_current(size_t index) {
+        return *(thread_t* volatile*) per_cpu_ptr(current_thread, index);
+}
+
+/*
+ * A cpu is idle when it runs its idle thread and has nothing queued.
+ */
+
+static bool cpu_is_idle(size_t index) {
+        thread_t *running = cpu_current(index);
+        return running != NULL && is_idle(running) && per_cpu_ptr(runqueue, index)->nr_queued == 0;
+}
+
+static void runqueue_push(runqueue_t *rq, thread_t *thread) {
+        uint32_t priority = thread->priority;
+        thread->next = NULL;
+        if (rq->tail[priority]) {
+                rq->tail[priority]->next = thread;
+        }
+        else {
+                rq->head[priority] = thread;
+        }
+        rq->tail[priority] = thread;
+        rq->bitmap |= 1U << priority;
+        rq->nr_queued++;
+}
+
+/*
+ * Highest priority with a queued thread or SCHED_PRIORITIES if the run queue is empty.
+ */
+
+static inline uint32_t runqueue_top_priority(runqueue_t *rq) {
+        return rq->bitmap ? (uint32_t) __builtin_ctz(rq->bitmap) : SCHED_PRIORITIES;
+}
+
+static thread_t* runqueue_pop(runqueue_t *rq) {
+        uint32_t priority = runqueue_top_priority(rq);
+        if (priority == SCHED_PRIORITIES) {
+                return NULL;
+        }
+        thread_t *thread = rq->head[priority];
+        rq->head[priority] = thread->next;
+        if (rq->head[priority] == NULL) {
+                rq->tail[priority] = NULL;
+                rq->bitmap &= ~(1U << priority);
+        }
+        rq->nr_queued--;
+        thread->next = NULL;
+        return thread;
+}
+
+static int resched_interrupt(interrupt_context_t *context, void *dev_id) {
+        (void) context;
+        (void) dev_id;
+        this_cpu_write(need_resched, true);
+        return INTERRUPT_HANDLED;
+}
+
+static interrupt_action_t resched_action = {
+        handler: resched_interrupt,
+        dev_id: NULL,
+        flags: 0,
+};
+
+/*
+ * Makes the cpu with the given index look at its run queue as soon as possible.
+ */
+
+static void kick_cpu(size_t index) {
+
+        // Callers can be preemptible, the calling cpu must not change between the test and the kick.
+
+        uint32_t eflags = arch_irq_save();
+        if (index == this_cpu_read(cpu_index)) {
+                this_cpu_write(need_resched, true);
+        }
+        else if (smp) {
+                smp_send_reschedule(index);
+        }
+        arch_irq_restore(eflags);
+}
+
+/*
+ * Wakes up an idle cpu other than busy so that it steals work.
+ */
+
+static void kick_idle_cpu(size_t busy) {
+        if (!smp) {
+                return;
+        }
+        for (size_t i = 0; i < num_cpus; i++) {
+                if (i != busy && cpumask_test(&cpu_online_mask, i) && cpu_is_idle(i)) {
+                        kick_cpu(i);
+                        return;
+                }
+        }
+}
+
+/*
+ * Queues thread on the given cpu, which reschedules if thread has a higher priority than what it is running. If that cpu
+ * keeps running something else an idle cpu is kicked to steal the thread.
+ */
+
+static void enqueue(thread_t *thread, size_t index) {
+        runqueue_t *rq = per_cpu_ptr(runqueue, index);
+        uint32_t eflags = lock_irqsave(&rq->lock);
+        runqueue_push(rq, thread);
+        unlock_irqrestore(&rq->lock, eflags);
+        thread_t *running = cpu_current(index);
+        if (running == NULL || is_idle(running) || thread->priority < running->priority) {
+                kick_cpu(index);
+        }
+        else {
+                kick_idle_cpu(index);
+        }
+}
+
+/*
+ * A woken up thread goes back to the cpu it last ran on, where its cache is warm, unless that cpu is busy and an idle cpu
+ * shares a cache with it: the closest such cpu is picked, hyperthread siblings first.
+ */
+
+static size_t select_wakeup_cpu(thread_t *thread) {
+        size_t last = thread->cpu;
+        if (!smp || (thread->flags & THREAD_FLAG_PINNED) || cpu_is_idle(last)) {
+                return last;
+        }
+        const cpumask_t *domains[] = {
+                topology_smt_siblings(last),
+                topology_cache_siblings(last, 2),
+                topology_cache_siblings(last, 3),
+        };
+        for (size_t domain = 0; domain < sizeof(domains) / sizeof(domains[0]); domain++) {
+                for (size_t i = 0; i < num_cpus; i++) {
+                        if (cpumask_test(domains[domain], i) && cpumask_test(&cpu_online_mask, i) && cpu_is_idle(i)) {
+                                return i;
+                        }
+                }
+        }
+        return last;
+}
+
+/*
+ * New threads have no warm cache anywhere: they go to the cpu with the fewest threads, the calling one on ties.
+ */
+
+static size_t select_new_cpu() {
+        size_t self = this_cpu_read(cpu_index);
+        if (!smp) {
+                return self;
+        }
+        size_t best = self;
+        uint32_t best_load = UINT32_MAX;
+        for (size_t n = 0; n < num_cpus; n++) {
+                size_t i = (self + n) % num_cpus;
+                if (!cpumask_test(&cpu_online_mask, i)) {
+                        continue;
+                }
+                thread_t *running = cpu_current(i);
+                uint32_t load = per_cpu_ptr(runqueue, i)->nr_queued + (running != NULL && !is_idle(running));
+                if (load < best_load) {
+                        best = i;
+                        best_load = load;
+                }
+        }
+        return best;
+}
+
+/*
+ * Takes the highest priority thread of rq that is not pinned to its cpu, or NULL if there is none.
+ */
+
+static thread_t* runqueue_pop_unpinned(runqueue_t *rq) {
+        uint32_t bitmap = rq->bitmap;
+        while (bitmap) {
+                uint32_t priority = (uint32_t) __builtin_ctz(bitmap);
+                bitmap &= bitmap - 1;
+                thread_t *prev = NULL;
+                for (thread_t *thread = rq->head[priority]; thread; prev = thread, thread = thread->next) {
+                        if (thread->flags & THREAD_FLAG_PINNED) {
+                                continue;
+                        }
+                        if (prev) {
+                                prev->next = thread->next;
+                        }
+                        else {
+                                rq->head[priority] = thread->next;
+                        }
+                        if (rq->tail[priority] == thread) {
+                                rq->tail[priority] = prev;
+                        }
+                        if (rq->head[priority] == NULL) {
+                                rq->bitmap &= ~(1U << priority);
+                        }
+                        rq->nr_queued--;
+                        thread->next = NULL;
+                        return thread;
+                }
+        }
+        return NULL;
+}
+
+/*
+ * Moves one thread to the run queue of this cpu from the busiest cpu of the closest domain having queued threads, so that
+ * the stolen thread stays as close as possible to its cache. Called with interrupts disabled and no run queue lock held.
+ * Returns true if a thread was stolen.
+ */
+
+static bool steal_work() {
+        if (!smp) {
+                return false;
+        }
+        size_t self = this_cpu_read(cpu_index);
+        const cpumask_t *domains[] = {
+                topology_smt_siblings(self),
+                topology_cache_siblings(self, 2),
+                topology_cache_siblings(self, 3),
+                topology_package_siblings(self),
+                &cpu_online_mask,
+        };
+        for (size_t domain = 0; domain < sizeof(domains) / sizeof(domains[0]); domain++) {
+                size_t busiest = self;
+                uint32_t busiest_queued = 0;
+                for (size_t i = 0; i < num_cpus; i++) {
+                        if (i == self || !cpumask_test(domains[domain], i) || !cpumask_test(&cpu_online_mask, i)) {
+                                continue;
+                        }
+                        uint32_t queued = per_cpu_ptr(runqueue, i)->nr_queued;
+                        if (queued > busiest_queued) {
+                                busiest = i;
+                                busiest_queued = queued;
+                        }
+                }
+                if (busiest == self) {
+                        continue;
+                }
+                runqueue_t *victim = per_cpu_ptr(runqueue, busiest);
+                lock(&victim->lock);
+                thread_t *thread = runqueue_pop_unpinned(victim);
+                unlock(&victim->lock);
+                if (thread == NULL) {
+                        continue;
+                }
+                runqueue_t *rq = this_cpu_ptr(runqueue);
+                lock(&rq->lock);
+                runqueue_push(rq, thread);
+                unlock(&rq->lock);
+                return true;
+        }
+        return false;
+}
+
+/*
+ * Turns the context the calling cpu is running on into its idle thread. Must be called by every cpu before cpu_idle().
+ * The idle thread has a priority lower than any other thread.
+ */
+
+void sched_init_cpu() {
+        thread_t *idle = this_cpu_ptr(idle_thread);
+        memset(idle, 0x0, sizeof(thread_t));
+        strcpy(idle->name, "idle");
+        idle->state = THREAD_RUNNABLE;
+        idle->flags = THREAD_FLAG_IDLE;
+        idle->priority = SCHED_PRIORITIES;
+        idle->on_cpu = true;
+        idle->cpu = this_cpu_read(cpu_index);
+        fpu_state_init(&idle->fpu);
+        this_cpu_write(timeslice, SCHED_TIMESLICE_TICKS);
+        this_cpu_write(current_thread, idle);
+}
+
+/*
+ * Called once by the BSP.
+ */
+
+void sched_init() {
+        if (smp && register_interrupt_handler(RESCHEDULE_VECTOR, &resched_action)) {
+                panic("[KERNEL]: Could not register interrupt handler! File: %s line: %d function: %s\n", __FILENAME__, __LINE__, __func__);
+        }
+        sched_init_cpu();
+}
+
+/*
+ * Switches to the highest priority runnable thread of this cpu. The running thread keeps the cpu if it is still runnable
+ * and every queued thread has a lower priority, otherwise it is queued again (behind the threads with its priority) or,
+ * if it is not runnable anymore, left alone until it is woken up. A cpu about to run out of work first tries to steal some.
+ * Every switch is an RCU quiescent state, since read side critical sections disable preemption.
+ * Must not be called with spinlocks held or from interrupt handlers.
+ */
+
+void schedule() {
+        if (this_cpu_read(preempt_count) != 0) {
+                panic("[KERNEL]: Scheduling while atomic! File: %s line: %d function: %s\n", __FILENAME__, __LINE__, __func__);
+        }
+        uint32_t eflags = arch_irq_save();
+        runqueue_t *rq = this_cpu_ptr(runqueue);
+        thread_t *prev = this_cpu_read(current_thread);
+        if (rq->nr_queued == 0 && (is_idle(prev) || prev->state != THREAD_RUNNABLE)) {
+                steal_work();
+        }
+        lock(&rq->lock);
+        this_cpu_write(need_resched, false);
+        uint32_t top = runqueue_top_priority(rq);
+        if (prev->state == THREAD_RUNNABLE && (top == SCHED_PRIORITIES || top > prev->priority)) {
+                unlock(&rq->lock);
+                arch_irq_restore(eflags);
+                return;
+        }
+        thread_t *next = runqueue_pop(rq);
+        if (next == NULL) {
+                next = this_cpu_ptr(idle_thread);
+        }
+        next->on_cpu = true;
+        next->cpu = this_cpu_read(cpu_index);
+        this_cpu_write(current_thread, next);
+        this_cpu_write(switch_prev, prev);
+        this_cpu_write(timeslice, SCHED_TIMESLICE_TICKS);
+        rcu_quiescent_state();
+        fpu_switch(&prev->fpu, &next->fpu);
+        user_context_switch(&prev->user, &next->user);
+        switch_context(&prev->esp, next->esp);
+        schedule_tail();
+        arch_irq_restore(eflags);
+}
+
+/*
+ * Run by a thread right after being switched to, with the run queue lock held and interrupts disabled: the context of the
+ * previous thread is saved now, so it can be queued again or, if it exited, handed to its joiner. The previous thread must
+ * not be touched once its lock is released: if it exited its joiner may free it.
+ */
+
+void schedule_tail() {
+        runqueue_t *rq = this_cpu_ptr(runqueue);
+        thread_t *prev = this_cpu_read(switch_prev);
+        unlock(&rq->lock);
+        if (is_idle(prev)) {
+                prev->on_cpu = false;
+                return;
+        }
+        thread_t *joiner = NULL;
+        lock(&prev->lock);
+        prev->on_cpu = false;
+        if (prev->state == THREAD_RUNNABLE) {
+                lock(&rq->lock);
+                runqueue_push(rq, prev);
+                unlock(&rq->lock);
+        }
+        else if (prev->state == THREAD_DEAD) {
+                joiner = prev->joiner;
+        }
+        unlock(&prev->lock);
+        if (joiner != NULL) {
+                sched_wakeup(joiner);
+        }
+}
+
+/*
+ * Reschedules right away if a thread with a higher priority was queued on this cpu and the running thread can be preempted.
+ */
+
+void preempt_check_resched() {
+        thread_t *current = this_cpu_read(current_thread);
+        if (current != NULL && !is_idle(current) && this_cpu_read(need_resched) && preemptible()) {
+                schedule();
+        }
+}
+
+/*
+ * Makes a new thread runnable, on its cpu if it is pinned.
+ */
+
+void sched_enqueue(thread_t *thread) {
+        thread->state = THREAD_RUNNABLE;
+        if (!(thread->flags & THREAD_FLAG_PINNED)) {
+                thread->cpu = select_new_cpu();
+        }
+        enqueue(thread, thread->cpu);
+        preempt_check_resched();
+}
+
+/*
+ * The idle thread never blocks (see sched_join()), so waking it up only means kicking its cpu.
+ */
+
+void sched_wakeup(thread_t *thread) {
+        if (is_idle(thread)) {
+                kick_cpu(thread->cpu);
+                return;
+        }
+        uint32_t eflags = lock_irqsave(&thread->lock);
+        if (thread->state == THREAD_BLOCKED) {
+                thread->state = THREAD_RUNNABLE;
+                if (!thread->on_cpu) {
+                        enqueue(thread, select_wakeup_cpu(thread));
+                }
+        }
+        unlock_irqrestore(&thread->lock, eflags);
+        preempt_check_resched();
+}
+
+static void set_state(thread_t *thread, uint32_t state) {
+        uint32_t eflags = lock_irqsave(&thread->lock);
+        thread->state = state;
+        unlock_irqrestore(&thread->lock, eflags);
+}
+
+/*
+ * Sets the state of the running thread. A thread going to sleep marks itself THREAD_BLOCKED, checks its wake up condition
+ * and calls schedule() only if it does not hold yet: a sched_wakeup() coming in between makes it runnable again, so it
+ * is not lost. The idle thread cannot block.
+ */
+
+void sched_set_state(uint32_t state) {
+        thread_t *self = this_cpu_read(current_thread);
+        if (!is_idle(self)) {
+                set_state(self, state);
+        }
+}
+
+/*
+ * Waits until thread exited and no cpu is running on its stack anymore. Only one thread may wait for a given thread.
+ * The waiter marks itself blocked before looking at thread, so a wakeup coming in between is not lost. The idle thread
+ * cannot block, so when it waits it runs the other runnable threads or halts until its cpu is kicked.
+ * Must be called with interrupts enabled.
+ */
+
+void sched_join(thread_t *thread) {
+        thread_t *self = this_cpu_read(current_thread);
+        while (true) {
+                if (!is_idle(self)) {
+                        set_state(self, THREAD_BLOCKED);
+                }
+                uint32_t eflags = lock_irqsave(&thread->lock);
+                thread->joiner = self;
+                bool done = thread->state == THREAD_DEAD && !thread->on_cpu;
+                unlock_irqrestore(&thread->lock, eflags);
+                if (done) {
+                        if (!is_idle(self)) {
+                                set_state(self, THREAD_RUNNABLE);
+                        }
+                        return;
+                }
+                schedule();
+
+                // The kick might have been consumed by schedule(), so check again with interrupts disabled before halting.
+
+                if (is_idle(self)) {
+                        arch_cli();
+                        if (thread->state != THREAD_DEAD || thread->on_cpu) {
+                                idle_wait();
+                        }
+                        arch_sti();
+                }
+        }
+}
+
+/*
+ * Marks the running thread dead and switches away from it for the last time.
+ */
+
+void sched_exit() {
+        arch_cli();
+        set_state(this_cpu_read(current_thread), THREAD_DEAD);
+        schedule();
+        panic("[KERNEL]: Dead thread scheduled! File: %s line: %d function: %s\n", __FILENAME__, __LINE__, __func__);
+        while (true) {
+                arch_halt();
+        }
+}
+
+/*
+ * Tells the idle loop whether it should call schedule() instead of halting: something is queued here or on another cpu.
+ */
+
+bool sched_idle_should_run() {
+        if (this_cpu_read(need_resched) || this_cpu_ptr(runqueue)->nr_queued != 0) {
+                return true;
+        }
+        for (size_t i = 0; smp && i < num_cpus; i++) {
+                if (cpumask_test(&cpu_online_mask, i) && per_cpu_ptr(runqueue, i)->nr_queued != 0) {
+                        return true;
+                }
+        }
+        return false;
+}
+
+/*
+ * Returns true if the cpu with the given index runs its idle thread and has nothing queued.
+ */
+
+bool sched_cpu_idle(size_t index) {
+        return cpu_is_idle(index);
+}
+
+/*
+ * Called on every timer tick: the running thread is preempted once its time slice is over and a thread with at least
+ * its priority is queued.
+ */
+
+void sched_tick() {
+        thread_t *current = this_cpu_read(current_thread);
+        if (current == NULL) {
+                return;
+        }
+        runqueue_t *rq = this_cpu_ptr(runqueue);
+        if (is_idle(current)) {
+                if (rq->nr_queued != 0) {
+                        this_cpu_write(need_resched, true);
+                }
+                return;
+        }
+        uint32_t left = this_cpu_read(timeslice);
+        if (left > 1) {
+                this_cpu_write(timeslice, left - 1);
+        }
+        else if (runqueue_top_priority(rq) <= current->priority) {
+                this_cpu_write(need_resched, true);
+        }
+}
+
+/*
+ * Called on the way out of every interrupt with the eflags of the interrupted context. The interrupted thread is preempted
+ * if a reschedule is pending and it was preemptible. The idle thread is never preempted here: the idle loop reschedules by
+ * itself and might be in an RCU extended quiescent state.
+ */
+
+void preempt_schedule_irq(uint32_t eflags) {
+        thread_t *current = this_cpu_read(current_thread);
+        if (current == NULL || is_idle(current) || !this_cpu_read(need_resched)) {
+                return;
+        }
+        if (this_cpu_read(preempt_count) != 0 || in_interrupt() || !(eflags & EFLAGS_INTERRUPT_ENABLE_FLAG_SET)) {
+                return;
+        }
+        schedule();
+}
@@ -0,0 +1,169 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <arch/atomic.h>
+#include <arch/cpu/cpu.h>
+#include <arch/cpu/fpu.h>
+#include <arch/cpu/smp.h>
+#include <arch/cpu/switch.h>
+#include <arch/kernel/mm/vm.h>
+#include <arch/mmu.h>
+#include <arch/types.h>
+#include <kernel/assert.h>
+#include <kernel/mm/pm.h>
+#include <kernel/printk.h>
+#include <kernel/sched.h>
+#include <kernel/spinlock.h>
+#include <kernel/thread.h>
+#include <lib/string.h>
+
+/*
+ * Thread stacks live in fixed size slots starting at KTHREAD_STACKS_START, the first page of every slot is the guard page
+ * and is never mapped. The stack pages of a slot are mapped the first time the slot is used and stay mapped once the slot
+ * is freed: reusing a slot costs nothing and no other cpu can be left with stale TLB entries for it.
+ * The thread control block sits at the top of the stack.
+ */
+
+#define KTHREAD_SLOT_SIZE ((KTHREAD_STACK_PAGES + 1) * PAGE_SIZE)
+#define KTHREAD_SLOT_ADDRESS(slot) ((virt_addr_t) KTHREAD_STACKS_START + ((slot) * KTHREAD_SLOT_SIZE))
+#define KTHREAD_CPU_ANY ((size_t) -1)
+
+static spinlock_t kthread_lock = {
+        name: "kthread",
+        lock: 0,
+};
+
+static size_t free_slots[KTHREAD_MAX];
+static size_t free_slots_count = 0;
+static size_t mapped_slots = 0;
+static atomic_t next_thread_id = ATOMIC_INIT(1);
+
+/*
+ * Returns the index of a slot with its stack mapped or -1 if there are no free slots or no memory left.
+ */
+
+static int stack_alloc(size_t *slot) {
+        lock(&kthread_lock);
+        if (free_slots_count > 0) {
+                *slot = free_slots[--free_slots_count];
+                unlock(&kthread_lock);
+                return 0;
+        }
+        if (mapped_slots == KTHREAD_MAX) {
+                unlock(&kthread_lock);
+                return -1;
+        }
+        virt_addr_t stack = KTHREAD_SLOT_ADDRESS(mapped_slots) + PAGE_SIZE;
+        for (size_t page = 0; page < KTHREAD_STACK_PAGES; page++) {
+                phys_addr_t frame = get_free_frame();
+                if (frame != (phys_addr_t) -1 && map_page(frame, stack + (page * PAGE_SIZE), PROT_PRESENT | PROT_READ_WRITE | PROT_KERN, false) == 0) {
+                        continue;
+                }
+                if (frame != (phys_addr_t) -1) {
+                        free_frame(frame);
+                }
+
+                // unmap_page() also gives the frames back to the physical memory manager.
+
+                while (page-- > 0) {
+                        unmap_page(stack + (page * PAGE_SIZE));
+                }
+                unlock(&kthread_lock);
+                return -1;
+        }
+        *slot = mapped_slots++;
+        unlock(&kthread_lock);
+        return 0;
+}
+
+static void stack_free(size_t slot) {
+        lock(&kthread_lock);
+        free_slots[free_slots_count++] = slot;
+        unlock(&kthread_lock);
+}
+
+/*
+ * First code run by a new thread, it is switched to from schedule() like any other thread.
+ */
+
+static void kthread_entry() {
+        schedule_tail();
+        arch_sti();
+        thread_t *self = thread_current();
+        kthread_exit(self->entry(self->arg));
+}
+
+/*
+ * Creates a thread running entry(arg) with the given priority and makes it runnable, pinned to cpu unless it is
+ * KTHREAD_CPU_ANY. The thread ends when entry returns or calls kthread_exit() and must be reaped with kthread_join().
+ * Returns NULL on failure.
+ */
+
+static thread_t* kthread_create_common(const char *name, thread_func_t entry, void *arg, uint32_t priority, size_t cpu) {
+        size_t slot;
+        if (entry == NULL || priority >= SCHED_PRIORITIES || (cpu != KTHREAD_CPU_ANY && (cpu >= num_cpus || !cpumask_test(&cpu_online_mask, cpu))) || stack_alloc(&slot)) {
+                return NULL;
+        }
+        virt_addr_t stack_top = KTHREAD_SLOT_ADDRESS(slot) + KTHREAD_SLOT_SIZE;
+        thread_t *thread = (thread_t*) ((stack_top - sizeof(thread_t)) & ~0xF);
+        memset(thread, 0x0, sizeof(thread_t));
+        for (size_t i = 0; name != NULL && name[i] != '\0' && i < THREAD_NAME_LENGTH - 1; i++) {
+                thread->name[i] = name[i];
+        }
+        strcpy(thread->lock.name, "thread");
+        thread->id = (uint32_t) atomic_fetch_add(&next_thread_id, 1);
+        thread->priority = priority;
+        thread->entry = entry;
+        thread->arg = arg;
+        thread->stack_slot = slot;
+        if (cpu != KTHREAD_CPU_ANY) {
+                thread->flags = THREAD_FLAG_PINNED;
+                thread->cpu = cpu;
+        }
+        fpu_state_init(&thread->fpu);
+        thread->esp = arch_thread_init_stack((virt_addr_t) thread, kthread_entry);
+        sched_enqueue(thread);
+        return thread;
+}
+
+thread_t* kthread_create_priority(const char *name, thread_func_t entry, void *arg, uint32_t priority) {
+        return kthread_create_common(name, entry, arg, priority, KTHREAD_CPU_ANY);
+}
+
+thread_t* kthread_create_on_cpu(const char *name, thread_func_t entry, void *arg, uint32_t priority, size_t cpu) {
+        return kthread_create_common(name, entry, arg, priority, cpu);
+}
+
+thread_t* kthread_create(const char *name, thread_func_t entry, void *arg) {
+        return kthread_create_priority(name, entry, arg, SCHED_PRIORITY_DEFAULT);
+}
+
+/*
+ * Waits for thread to end and frees it. If exit_code is not NULL the value thread returned is stored there.
+ * A thread can only be joined once and not by itself. Returns 0 on success and -1 on invalid arguments.
+ */
+
+int kthread_join(thread_t *thread, int *exit_code) {
+        if (thread == NULL || thread == thread_current() || (thread->flags & THREAD_FLAG_IDLE)) {
+                return -1;
+        }
+        sched_join(thread);
+        if (exit_code) {
+                *exit_code = thread->exit_code;
+        }
+        stack_free(thread->stack_slot);
+        return 0;
+}
+
+void kthread_yield() {
+        schedule();
+}
+
+void kthread_exit(int exit_code) {
+        thread_t *self = thread_current();
+        if (self->flags & THREAD_FLAG_IDLE) {
+                panic("[KERNEL]: The idle thread cannot exit! File: %s line: %d function: %s\n", __FILENAME__, __LINE__, __func__);
+        }
+        self->exit_code = exit_code;
+        sched_exit();
+}
@@ -0,0 +1,190 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <arch/atomic.h>
+#include <arch/cpu/cpu.h>
+#include <arch/cpu/percpu.h>
+#include <arch/cpu/smp.h>
+#include <kernel/assert.h>
+#include <kernel/clocksource.h>
+#include <kernel/preempt.h>
+#include <kernel/sched.h>
+#include <kernel/softirq.h>
+#include <kernel/thread.h>
+#include <kernel/timer.h>
+
+DEFINE_PER_CPU(uint32_t, softirq_pending);
+
+// Tasklets scheduled on this cpu and not run yet, in scheduling order.
+
+DEFINE_PER_CPU(tasklet_t*, tasklet_head);
+DEFINE_PER_CPU(tasklet_t**, tasklet_tail);
+DEFINE_PER_CPU(thread_t*, ksoftirqd);
+
+static void tasklet_softirq(void);
+
+static softirq_handler_t softirq_table[SOFTIRQ_MAX] = {
+        [SOFTIRQ_TIMER] = timer_softirq,
+        [SOFTIRQ_TASKLET] = tasklet_softirq,
+};
+
+static void wakeup_ksoftirqd() {
+        thread_t *thread = this_cpu_read(ksoftirqd);
+        if (thread != NULL) {
+                sched_wakeup(thread);
+        }
+}
+
+/*
+ * Runs the pending softirqs of this cpu within the budget and hands what is left to ksoftirqd. Called with interrupts
+ * disabled and irq_count raised by the caller, which keeps nested interrupts from running softirqs themselves.
+ */
+
+static void do_softirq() {
+        uint64_t end = ktime_get_ns() + SOFTIRQ_BUDGET_NS;
+        uint32_t restart = SOFTIRQ_MAX_RESTART;
+        uint32_t pending;
+        while ((pending = this_cpu_read(softirq_pending)) != 0) {
+                this_cpu_write(softirq_pending, 0);
+                arch_sti();
+                while (pending) {
+                        uint32_t nr = (uint32_t) __builtin_ctz(pending);
+                        pending &= pending - 1;
+                        softirq_table[nr]();
+                }
+                arch_cli();
+                if (--restart == 0 || ktime_get_ns() >= end) {
+                        break;
+                }
+        }
+        if (this_cpu_read(softirq_pending) != 0) {
+                wakeup_ksoftirqd();
+        }
+}
+
+/*
+ * Must be called with interrupts disabled.
+ */
+
+void raise_softirq_irqoff(uint32_t nr) {
+        this_cpu_write(softirq_pending, this_cpu_read(softirq_pending) | (1U << nr));
+}
+
+/*
+ * Outside of interrupts nothing would run the softirq soon, so ksoftirqd is woken up.
+ */
+
+void raise_softirq(uint32_t nr) {
+        uint32_t eflags = arch_irq_save();
+        raise_softirq_irqoff(nr);
+        if (!in_interrupt()) {
+                wakeup_ksoftirqd();
+        }
+        arch_irq_restore(eflags);
+}
+
+/*
+ * Called by the interrupt dispatcher once the interrupt is acknowledged, with interrupts disabled. Only the outermost
+ * interrupt runs softirqs.
+ */
+
+void softirq_irq_exit() {
+        if (this_cpu_read(irq_count) == 1 && this_cpu_read(softirq_pending) != 0) {
+                do_softirq();
+        }
+}
+
+/*
+ * Runs the softirqs left over by interrupts, accounted as interrupt context like they are there.
+ */
+
+static int ksoftirqd_thread(void *arg) {
+        (void) arg;
+        while (true) {
+                sched_set_state(THREAD_BLOCKED);
+                if (!softirq_is_pending()) {
+                        schedule();
+                }
+                sched_set_state(THREAD_RUNNABLE);
+                uint32_t eflags = arch_irq_save();
+                this_cpu_inc(irq_count);
+                do_softirq();
+                this_cpu_dec(irq_count);
+                arch_irq_restore(eflags);
+                preempt_check_resched();
+        }
+        return 0;
+}
+
+/*
+ * Starts the ksoftirqd thread of every online cpu. Called once by the BSP after sched_init(), softirqs left over before
+ * that wait for the next interrupt.
+ */
+
+void softirq_init() {
+        for (size_t i = 0; i < num_cpus; i++) {
+                if (!cpumask_test(&cpu_online_mask, i)) {
+                        continue;
+                }
+                thread_t *thread = kthread_create_on_cpu("ksoftirqd", ksoftirqd_thread, NULL, SCHED_PRIORITY_DEFAULT, i);
+                if (thread == NULL) {
+                        panic("[KERNEL]: Failed to create ksoftirqd! File: %s line: %d function: %s\n", __FILENAME__, __LINE__, __func__);
+                }
+                *per_cpu_ptr(ksoftirqd, i) = thread;
+        }
+}
+
+void tasklet_init(tasklet_t *tasklet, tasklet_func_t function, void *arg) {
+        tasklet->next = NULL;
+        tasklet->state = 0;
+        tasklet->function = function;
+        tasklet->arg = arg;
+}
+
+static void tasklet_queue(tasklet_t *tasklet) {
+        tasklet_t **tail = this_cpu_read(tasklet_tail);
+        if (tail == NULL) {
+                tail = this_cpu_ptr(tasklet_head);
+        }
+        tasklet->next = NULL;
+        *tail = tasklet;
+        this_cpu_write(tasklet_tail, &tasklet->next);
+        raise_softirq_irqoff(SOFTIRQ_TASKLET);
+}
+
+void tasklet_schedule(tasklet_t *tasklet) {
+        if (arch_test_and_set_bit(TASKLET_STATE_SCHEDULED, &tasklet->state)) {
+                return;
+        }
+        uint32_t eflags = arch_irq_save();
+        tasklet_queue(tasklet);
+        if (!in_interrupt()) {
+                wakeup_ksoftirqd();
+        }
+        arch_irq_restore(eflags);
+}
+
+/*
+ * A tasklet still running on another cpu is queued again for the next pass.
+ */
+
+static void tasklet_softirq() {
+        uint32_t eflags = arch_irq_save();
+        tasklet_t *list = this_cpu_read(tasklet_head);
+        this_cpu_write(tasklet_head, NULL);
+        this_cpu_write(tasklet_tail, NULL);
+        arch_irq_restore(eflags);
+        while (list) {
+                tasklet_t *tasklet = list;
+                list = list->next;
+                if (arch_test_and_set_bit(TASKLET_STATE_RUNNING, &tasklet->state)) {
+                        eflags = arch_irq_save();
+                        tasklet_queue(tasklet);
+                        arch_irq_restore(eflags);
+                        continue;
+                }
+                arch_clear_bit(TASKLET_STATE_SCHEDULED, &tasklet->state);
+                tasklet->function(tasklet->arg);
+                arch_clear_bit(TASKLET_STATE_RUNNING, &tasklet->state);
+        }
+}
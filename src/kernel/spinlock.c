@@ -1,21 +1,242 @@
+#include <stdbool.h>
+#include <stdint.h>
 #include <arch/cpu/cpu.h>
+#include <arch/cpu/percpu.h>
 #include <arch/cpu/smp.h>
+#include <kernel/lockstat.h>
+#include <kernel/preempt.h>
 #include <kernel/spinlock.h>
 
+DEFINE_PER_CPU(uint32_t, preempt_count);
+
+/*
+ * On UP systems spinlocks reduce to disabling interrupts. The interrupt state found by the outermost lock is saved
+ * and only given back by the matching outermost unlock, so nested locks never enable interrupts early.
+ */
+
+DEFINE_PER_CPU(uint32_t, irq_disable_depth);
+DEFINE_PER_CPU(uint32_t, irq_saved_eflags);
+
+static inline void up_irq_disable() {
+        uint32_t eflags = arch_irq_save();
+        if (this_cpu_read(irq_disable_depth) == 0) {
+                this_cpu_write(irq_saved_eflags, eflags);
+        }
+        this_cpu_inc(irq_disable_depth);
+}
+
+static inline void up_irq_enable() {
+        this_cpu_dec(irq_disable_depth);
+        if (this_cpu_read(irq_disable_depth) == 0) {
+                arch_irq_restore(this_cpu_read(irq_saved_eflags));
+        }
+}
+
+/*
+ * Cpus acquire the lock in the order they took their ticket. A waiting cpu backs off proportionally
+ * to the number of cpus ahead of it so that it does not keep stealing the lock cache line from the owner.
+ */
+
 inline void lock(spinlock_t *lock) {
+        #ifdef LOCKSTAT
+                uint64_t spin_start = read_tsc();
+                bool contended = false;
+        #endif
+        preempt_disable();
         if (!smp) {
-                arch_cli();
+                up_irq_disable();
         }
         else {
-                while(arch_atomic_swap(1, &(lock->lock)) != 0);
+                uint16_t ticket = arch_atomic_fetch_add(1 << SPINLOCK_TICKET_SHIFT, &lock->lock) >> SPINLOCK_TICKET_SHIFT;
+                while (true) {
+                        uint16_t owner = lock->lock & SPINLOCK_OWNER_MASK;
+                        if (owner == ticket) {
+                                break;
+                        }
+                        #ifdef LOCKSTAT
+                                contended = true;
+                        #endif
+                        for (uint32_t i = (uint16_t) (ticket - owner) * SPINLOCK_BACKOFF_PAUSES; i > 0; i--) {
+                                arch_pause();
+                        }
+                }
+                arch_compiler_barrier();
+        }
+        #ifdef LOCKSTAT
+                lockstat_acquired(lock, contended, read_tsc() - spin_start);
+        #endif
+}
+
+/*
+ * Takes the lock only if it is free. Returns true if the lock was taken.
+ */
+
+inline bool try_lock(spinlock_t *lock) {
+        preempt_disable();
+        if (!smp) {
+                up_irq_disable();
+                #ifdef LOCKSTAT
+                        lockstat_acquired(lock, false, 0);
+                #endif
+                return true;
+        }
+        uint32_t value = lock->lock;
+        if ((value >> SPINLOCK_TICKET_SHIFT) == (value & SPINLOCK_OWNER_MASK) && arch_atomic_compare_exchange(value, value + (1 << SPINLOCK_TICKET_SHIFT), &lock->lock) == value) {
+                #ifdef LOCKSTAT
+                        lockstat_acquired(lock, false, 0);
+                #endif
+                return true;
         }
+        preempt_enable();
+        return false;
 }
 
+/*
+ * Only the owner writes the low half, so it does not need a locked instruction.
+ */
+
 inline void unlock(spinlock_t *lock) {
+        #ifdef LOCKSTAT
+                lockstat_released(lock);
+        #endif
+        if (!smp) {
+                up_irq_enable();
+        }
+        else {
+                asm volatile("incw %0" : "+m" (lock->lock) : : "memory");
+        }
+        preempt_enable();
+}
+
+/*
+ * Variants for locks also taken from interrupt handlers: interrupts stay disabled while the lock is held
+ * and the previous interrupt state (returned by lock_irqsave()) is given back on release.
+ */
+
+uint32_t lock_irqsave(spinlock_t *lock_p) {
+        uint32_t eflags = arch_irq_save();
+        lock(lock_p);
+        return eflags;
+}
+
+void unlock_irqrestore(spinlock_t *lock_p, uint32_t eflags) {
+        unlock(lock_p);
+        arch_irq_restore(eflags);
+}
+
+void mcs_lock(mcs_lock_t *lock, mcs_node_t *node) {
+        preempt_disable();
+        if (!smp) {
+                up_irq_disable();
+                return;
+        }
+        node->next = NULL;
+        node->locked = 1;
+        mcs_node_t *previous = (mcs_node_t*) arch_atomic_swap((uint32_t) node, (volatile uint32_t*) &lock->tail);
+        if (previous != NULL) {
+                previous->next = node;
+                while (node->locked) {
+                        arch_pause();
+                }
+        }
+        arch_compiler_barrier();
+}
+
+/*
+ * If there is no successor the lock is released by resetting the tail. If that fails a successor
+ * is enqueueing itself and the lock is handed to it once it linked its node.
+ */
+
+void mcs_unlock(mcs_lock_t *lock, mcs_node_t *node) {
+        if (!smp) {
+                up_irq_enable();
+                preempt_enable();
+                return;
+        }
+        arch_compiler_barrier();
+        if (node->next == NULL) {
+                if (arch_atomic_compare_exchange((uint32_t) node, 0, (volatile uint32_t*) &lock->tail) == (uint32_t) node) {
+                        preempt_enable();
+                        return;
+                }
+                while (node->next == NULL) {
+                        arch_pause();
+                }
+        }
+        node->next->locked = 0;
+        preempt_enable();
+}
+
+/*
+ * Readers first wait for pending writers to be served, then register themselves and back off again if a writer
+ * got the lock in the meantime.
+ */
+
+void read_lock(rwlock_t *lock) {
+        preempt_disable();
+        if (!smp) {
+                up_irq_disable();
+                return;
+        }
+        while (true) {
+                while (lock->writers_waiting || (lock->state & RWLOCK_WRITER)) {
+                        arch_pause();
+                }
+                if (!(arch_atomic_fetch_add(1, &lock->state) & RWLOCK_WRITER)) {
+                        break;
+                }
+                arch_atomic_fetch_add(-1, &lock->state);
+        }
+        arch_compiler_barrier();
+}
+
+void read_unlock(rwlock_t *lock) {
+        if (!smp) {
+                up_irq_enable();
+        }
+        else {
+                arch_atomic_fetch_add(-1, &lock->state);
+        }
+        preempt_enable();
+}
+
+/*
+ * A writer announces itself first, which keeps new readers out, then waits for the current readers to leave.
+ */
+
+void write_lock(rwlock_t *lock) {
+        preempt_disable();
+        if (!smp) {
+                up_irq_disable();
+                return;
+        }
+        arch_atomic_fetch_add(1, &lock->writers_waiting);
+        while (lock->state != 0 || arch_atomic_compare_exchange(0, RWLOCK_WRITER, &lock->state) != 0) {
+                arch_pause();
+        }
+        arch_atomic_fetch_add(-1, &lock->writers_waiting);
+}
+
+void write_unlock(rwlock_t *lock) {
         if (!smp) {
-                arch_sti();
+                up_irq_enable();
         }
         else {
-                lock->lock = 0;
+
+                // Readers backing off may have their increment in flight, only the writer bit is taken away.
+
+                arch_atomic_fetch_add(-RWLOCK_WRITER, &lock->state);
         }
-}
\ No newline at end of file
+        preempt_enable();
+}
+
+uint32_t write_lock_irqsave(rwlock_t *lock) {
+        uint32_t eflags = arch_irq_save();
+        write_lock(lock);
+        return eflags;
+}
+
+void write_unlock_irqrestore(rwlock_t *lock, uint32_t eflags) {
+        write_unlock(lock);
+        arch_irq_restore(eflags);
+}
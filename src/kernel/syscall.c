@@ -0,0 +1,27 @@
+#include <stdint.h>
+#include <arch/cpu/syscall.h>
+#include <kernel/sched.h>
+#include <kernel/syscall.h>
+#include <kernel/thread.h>
+
+static uint32_t sys_exit(uint32_t code, uint32_t unused1, uint32_t unused2) {
+        (void) unused1;
+        (void) unused2;
+        arch_leave_user((int) code);
+}
+
+/*
+ * There are no processes yet, the id of the running thread stands for the process id.
+ */
+
+static uint32_t sys_getpid(uint32_t unused0, uint32_t unused1, uint32_t unused2) {
+        (void) unused0;
+        (void) unused1;
+        (void) unused2;
+        return thread_current()->id;
+}
+
+syscall_t syscall_table[SYSCALL_MAX] = {
+        [SYS_EXIT] = sys_exit,
+        [SYS_GETPID] = sys_getpid,
+};
@@ -0,0 +1,69 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <kernel/clockevents.h>
+#include <kernel/tick.h>
+
+/*
+ * Hands a device of the calling cpu over to the tick layer, which picks its mode and starts the tick.
+ * Returns -1 if the device has no usable mode.
+ */
+
+int clockevents_register_device(clock_event_device_t *device) {
+        if (!(device->features & (CLOCK_EVT_FEAT_PERIODIC | CLOCK_EVT_FEAT_ONESHOT)) || device->set_state_shutdown == NULL) {
+                return -1;
+        }
+        device->state = CLOCK_EVT_STATE_SHUTDOWN;
+        device->event_handler = NULL;
+        return tick_setup_device(device);
+}
+
+/*
+ * Returns -1 if the device does not support the state or failed to enter it.
+ */
+
+int clockevents_switch_state(clock_event_device_t *device, uint32_t state) {
+        if (device->state == state) {
+                return 0;
+        }
+        int (*set_state)(clock_event_device_t*) = NULL;
+        switch (state) {
+                case CLOCK_EVT_STATE_SHUTDOWN:
+                        set_state = device->set_state_shutdown;
+                        break;
+                case CLOCK_EVT_STATE_PERIODIC:
+                        if (device->features & CLOCK_EVT_FEAT_PERIODIC) {
+                                set_state = device->set_state_periodic;
+                        }
+                        break;
+                case CLOCK_EVT_STATE_ONESHOT:
+                        if (device->features & CLOCK_EVT_FEAT_ONESHOT) {
+                                set_state = device->set_state_oneshot;
+                        }
+                        break;
+        }
+        if (set_state == NULL || set_state(device)) {
+                return -1;
+        }
+        device->state = state;
+        return 0;
+}
+
+/*
+ * Programs a one shot device to fire at the time expires, now being the current time. Expired events fire after the
+ * minimum delay of the device and events too far away fire early, when the device cannot wait that long.
+ */
+
+int clockevents_program_event(clock_event_device_t *device, uint64_t expires, uint64_t now) {
+        if (device->state != CLOCK_EVT_STATE_ONESHOT) {
+                return -1;
+        }
+        uint64_t delta = expires > now ? expires - now : 0;
+        if (delta < device->min_delta_ns) {
+                delta = device->min_delta_ns;
+        }
+        if (delta > device->max_delta_ns) {
+                delta = device->max_delta_ns;
+        }
+        return device->set_next_event(delta, device);
+}
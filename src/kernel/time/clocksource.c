@@ -0,0 +1,94 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <arch/cpu/cpu.h>
+#include <kernel/clocksource.h>
+#include <kernel/printk.h>
+#include <kernel/seqlock.h>
+
+/*
+ * Timekeeping state: the clocksource in use, its count when it was selected and the time at that moment. Readers copy it
+ * under the sequence counter and never write shared memory. It is only written by clocksource_register(), with
+ * interrupts disabled, so ktime_get_ns() can be used anywhere including interrupt handlers.
+ */
+
+static clocksource_t *current_clocksource = NULL;
+static uint64_t cycle_base = 0;
+static uint64_t ns_base = 0;
+
+static seqlock_t timekeeping_lock = {
+        count: {
+                sequence: 0,
+        },
+        lock: {
+                name: "ktime",
+                lock: 0,
+        },
+};
+
+static inline uint64_t timekeeping_read_ns(clocksource_t *clocksource) {
+        return ns_base + mul_u64_u32_shr(clocksource->read(clocksource) - cycle_base, clocksource->mult, clocksource->shift);
+}
+
+/*
+ * Nanoseconds since the first clocksource was registered, 0 before that. Monotonic across clocksource changes.
+ */
+
+uint64_t ktime_get_ns() {
+        uint32_t sequence;
+        uint64_t ns;
+        do {
+                sequence = read_seqbegin(&timekeeping_lock);
+                clocksource_t *clocksource = current_clocksource;
+                ns = clocksource ? timekeeping_read_ns(clocksource) : 0;
+        } while (read_seqretry(&timekeeping_lock, sequence));
+        return ns;
+}
+
+/*
+ * How long the clocksource in use may go unread (see clocksource_t), 0 if there is no limit.
+ */
+
+uint64_t clocksource_max_idle_ns() {
+        uint32_t sequence;
+        uint64_t max_idle_ns;
+        do {
+                sequence = read_seqbegin(&timekeeping_lock);
+                max_idle_ns = current_clocksource ? current_clocksource->max_idle_ns : 0;
+        } while (read_seqretry(&timekeeping_lock, sequence));
+        return max_idle_ns;
+}
+
+/*
+ * Computes the conversion factors of clocksource and switches to it if it is better rated than the one in use: the time
+ * keeps going on from where the previous clocksource left it. Returns -1 if clocksource cannot be read or has no frequency.
+ */
+
+int clocksource_register(clocksource_t *clocksource) {
+        if (clocksource->read == NULL || clocksource->frequency == 0) {
+                return -1;
+        }
+
+        // The largest shift (so the most precise conversion) whose multiplier still fits 32 bits.
+
+        uint32_t shift = 32;
+        while (shift > 0 && (NSEC_PER_SEC << shift) / clocksource->frequency > 0xFFFFFFFF) {
+                shift--;
+        }
+        clocksource->shift = shift;
+        clocksource->mult = (uint32_t) ((NSEC_PER_SEC << shift) / clocksource->frequency);
+        bool selected = false;
+        uint32_t eflags = write_seqlock_irqsave(&timekeeping_lock);
+        if (current_clocksource == NULL || clocksource->rating > current_clocksource->rating) {
+                uint64_t now = current_clocksource ? timekeeping_read_ns(current_clocksource) : 0;
+                cycle_base = clocksource->read(clocksource);
+                ns_base = now;
+                current_clocksource = clocksource;
+                selected = true;
+        }
+        write_sequnlock_irqrestore(&timekeeping_lock, eflags);
+        if (selected) {
+                printk("[KERNEL]: Clocksource: %s, %d kHz.\n", clocksource->name, (uint32_t) (clocksource->frequency / 1000));
+        }
+        return 0;
+}
@@ -0,0 +1,28 @@
+#include <stdint.h>
+#include <arch/cpu/cpu.h>
+#include <kernel/clocksource.h>
+#include <kernel/delay.h>
+
+/*
+ * Busy waits on ktime_get_ns(): they need neither interrupts nor the scheduler and are as precise as the clocksource in
+ * use (a few nanoseconds with the TSC). Must not be called before a clocksource is registered.
+ */
+
+static void delay_ns(uint64_t ns) {
+        uint64_t end = ktime_get_ns() + ns;
+        while (ktime_get_ns() < end) {
+                arch_pause();
+        }
+}
+
+void ndelay(uint32_t ns) {
+        delay_ns(ns);
+}
+
+void udelay(uint32_t us) {
+        delay_ns(us * NSEC_PER_USEC);
+}
+
+void mdelay(uint32_t ms) {
+        delay_ns(ms * NSEC_PER_MSEC);
+}
@@ -0,0 +1,233 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <arch/cpu/cpu.h>
+#include <arch/cpu/percpu.h>
+#include <kernel/clockevents.h>
+#include <kernel/clocksource.h>
+#include <kernel/sched.h>
+#include <kernel/seqlock.h>
+#include <kernel/thread.h>
+#include <kernel/tick.h>
+#include <kernel/timer.h>
+#include <lib/string.h>
+
+/*
+ * Every cpu ticks on its own clock event device. When the device has a one shot mode every tick programs the next one
+ * TICK_NSEC after it and an idle cpu stops its tick altogether until something wakes it up: the ticks it skipped are
+ * accounted when it does. Only devices without a one shot mode tick periodically, even while idle.
+ * Jiffies are computed from the clock by whichever cpu takes a tick, so they keep counting as long as one cpu is awake
+ * and catch up as soon as one wakes up.
+ */
+
+static uint64_t jiffies = 0;
+static uint64_t last_jiffies_update = 0;
+
+static seqlock_t jiffies_lock = {
+        count: {
+                sequence: 0,
+        },
+        lock: {
+                name: "jiffies",
+                lock: 0,
+        },
+};
+
+DEFINE_PER_CPU(tick_sched_t, tick_cpu_sched);
+
+static void tick_do_update_jiffies(uint64_t now) {
+        uint32_t sequence;
+        uint64_t last;
+
+        // Most ticks have nothing to do here (another cpu already did it), find out without taking the lock.
+
+        do {
+                sequence = read_seqbegin(&jiffies_lock);
+                last = last_jiffies_update;
+        } while (read_seqretry(&jiffies_lock, sequence));
+        if (now - last < TICK_NSEC) {
+                return;
+        }
+        uint32_t eflags = write_seqlock_irqsave(&jiffies_lock);
+        if (now >= last_jiffies_update + TICK_NSEC) {
+                uint64_t ticks = (now - last_jiffies_update) / TICK_NSEC;
+                jiffies += ticks;
+                last_jiffies_update += ticks * TICK_NSEC;
+        }
+        write_sequnlock_irqrestore(&jiffies_lock, eflags);
+}
+
+/*
+ * Reads the jiffies and, if last_update is not NULL, the time they were last updated at.
+ */
+
+static uint64_t jiffies_read(uint64_t *last_update) {
+        uint32_t sequence;
+        uint64_t value;
+        uint64_t last;
+        do {
+                sequence = read_seqbegin(&jiffies_lock);
+                value = jiffies;
+                last = last_jiffies_update;
+        } while (read_seqretry(&jiffies_lock, sequence));
+        if (last_update) {
+                *last_update = last;
+        }
+        return value;
+}
+
+/*
+ * Number of ticks since the first cpu started ticking. They are brought up to date first, in case every cpu was idle.
+ */
+
+uint64_t get_jiffies() {
+        tick_do_update_jiffies(ktime_get_ns());
+        return jiffies_read(NULL);
+}
+
+static void tick_account(tick_sched_t *ts, uint64_t ticks) {
+        thread_t *current = thread_current();
+        if (current != NULL && (current->flags & THREAD_FLAG_IDLE)) {
+                ts->idle_ticks += ticks;
+        }
+        else {
+                ts->busy_ticks += ticks;
+        }
+}
+
+static void tick_handle_periodic(clock_event_device_t *device) {
+        (void) device;
+        tick_do_update_jiffies(ktime_get_ns());
+        tick_account(this_cpu_ptr(tick_cpu_sched), 1);
+        sched_tick();
+        timer_tick(jiffies_read(NULL));
+}
+
+/*
+ * The next tick is programmed from the time the current one was due, not from now, so the tick does not drift.
+ * Ticks missed because interrupts were disabled for too long are accounted but not fired back to back.
+ * While the tick is stopped the device only fires for the next timer or when it could not wait any longer, the tick is
+ * then restarted by tick_nohz_idle_exit().
+ */
+
+static void tick_handle_oneshot(clock_event_device_t *device) {
+        tick_sched_t *ts = this_cpu_ptr(tick_cpu_sched);
+        uint64_t now = ktime_get_ns();
+        tick_do_update_jiffies(now);
+        if (ts->stopped) {
+                timer_tick(jiffies_read(NULL));
+                return;
+        }
+        uint64_t ticks = 1;
+        if (now >= ts->next_tick) {
+                ticks = ((now - ts->next_tick) / TICK_NSEC) + 1;
+        }
+        tick_account(ts, ticks);
+        ts->next_tick += ticks * TICK_NSEC;
+        clockevents_program_event(device, ts->next_tick, now);
+        sched_tick();
+        timer_tick(jiffies_read(NULL));
+}
+
+/*
+ * Starts the tick of the calling cpu on device, one shot if the device supports it. Returns -1 on failure.
+ */
+
+int tick_setup_device(clock_event_device_t *device) {
+        tick_sched_t *ts = this_cpu_ptr(tick_cpu_sched);
+        uint32_t eflags = arch_irq_save();
+        uint64_t now = ktime_get_ns();
+        write_seqlock(&jiffies_lock);
+        if (last_jiffies_update == 0) {
+                last_jiffies_update = now;
+        }
+        write_sequnlock(&jiffies_lock);
+        timer_init_cpu();
+
+        // The per cpu areas of the APs are copies of the one of the BSP, which might already be ticking.
+
+        memset(ts, 0x0, sizeof(tick_sched_t));
+        ts->device = device;
+        if (device->features & CLOCK_EVT_FEAT_ONESHOT) {
+                device->event_handler = tick_handle_oneshot;
+                ts->next_tick = now + TICK_NSEC;
+                if (clockevents_switch_state(device, CLOCK_EVT_STATE_ONESHOT) || clockevents_program_event(device, ts->next_tick, now)) {
+                        arch_irq_restore(eflags);
+                        return -1;
+                }
+        }
+        else {
+                device->event_handler = tick_handle_periodic;
+                if (clockevents_switch_state(device, CLOCK_EVT_STATE_PERIODIC)) {
+                        arch_irq_restore(eflags);
+                        return -1;
+                }
+        }
+        arch_irq_restore(eflags);
+        return 0;
+}
+
+/*
+ * Stops the tick of the calling cpu before it halts, until its next timer. Its timers are handed over to a busy cpu when
+ * there is one. Must be called by the idle loop with interrupts disabled.
+ * The cpu sleeps at most as long as its device and the clocksource can wait: it is woken up earlier by the reschedule
+ * interrupt when it gets work. The tick keeps going if a timer is due by the next tick.
+ */
+
+void tick_nohz_idle_enter() {
+        tick_sched_t *ts = this_cpu_ptr(tick_cpu_sched);
+        clock_event_device_t *device = ts->device;
+        if (device == NULL || device->state != CLOCK_EVT_STATE_ONESHOT || ts->stopped) {
+                return;
+        }
+        timer_migrate_idle();
+        uint64_t now = ktime_get_ns();
+        uint64_t sleep = device->max_delta_ns;
+        uint64_t max_idle = clocksource_max_idle_ns();
+        if (max_idle != 0 && max_idle < sleep) {
+                sleep = max_idle;
+        }
+        uint64_t next_timer = timer_next_expiry();
+        if (next_timer != TIMER_NO_EXPIRY) {
+                uint64_t last_update;
+                uint64_t current = jiffies_read(&last_update);
+                if (next_timer <= current + 1) {
+                        return;
+                }
+
+                // Jiffy next_timer starts (next_timer - current) ticks after the last update.
+
+                uint64_t expires = last_update + ((next_timer - current) * TICK_NSEC);
+                if (expires > now && expires - now < sleep) {
+                        sleep = expires - now;
+                }
+        }
+        ts->idle_entry = now;
+        ts->stopped = true;
+        ts->stops++;
+        clockevents_program_event(device, now + sleep, now);
+}
+
+/*
+ * Restarts the tick of the calling cpu once it woke up, in phase with the ticks it skipped, and accounts them as idle.
+ */
+
+void tick_nohz_idle_exit() {
+        uint32_t eflags = arch_irq_save();
+        tick_sched_t *ts = this_cpu_ptr(tick_cpu_sched);
+        if (!ts->stopped) {
+                arch_irq_restore(eflags);
+                return;
+        }
+        uint64_t now = ktime_get_ns();
+        ts->stopped = false;
+        ts->idle_sleeptime += now - ts->idle_entry;
+        tick_do_update_jiffies(now);
+        if (now >= ts->next_tick) {
+                uint64_t ticks = ((now - ts->next_tick) / TICK_NSEC) + 1;
+                ts->idle_ticks += ticks;
+                ts->next_tick += ticks * TICK_NSEC;
+        }
+        clockevents_program_event(ts->device, ts->next_tick, now);
+        arch_irq_restore(eflags);
+}
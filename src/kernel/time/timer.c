@@ -0,0 +1,307 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <arch/cpu/cpu.h>
+#include <arch/cpu/percpu.h>
+#include <arch/cpu/smp.h>
+#include <arch/cpu/smp_call.h>
+#include <kernel/sched.h>
+#include <kernel/softirq.h>
+#include <kernel/spinlock.h>
+#include <kernel/tick.h>
+#include <kernel/timer.h>
+#include <lib/string.h>
+
+/*
+ * Every cpu runs the timers of its own wheel: its tick raises the timer softirq when some are due (see timer_tick()). A
+ * timer is queued on the wheel of the cpu adding it, a cpu stopping its tick hands its timers over to a busy cpu.
+ * Callbacks run from the timer softirq with interrupts enabled and must not sleep, they can add and cancel timers
+ * (including their own).
+ * Timers fire at their exact tick, the levels only decide when they reach the root level.
+ */
+
+DEFINE_PER_CPU(timer_base_t, timer_bases) = {
+        lock: {
+                name: "timer",
+                lock: 0,
+        },
+};
+
+static inline void timer_list_add(timer_t **head, timer_t *timer) {
+        timer->next = *head;
+        if (*head) {
+                (*head)->pprev = &timer->next;
+        }
+        *head = timer;
+        timer->pprev = head;
+}
+
+static inline void timer_list_del(timer_t *timer) {
+        *timer->pprev = timer->next;
+        if (timer->next) {
+                timer->next->pprev = timer->pprev;
+        }
+        timer->next = NULL;
+        timer->pprev = NULL;
+}
+
+/*
+ * Queues timer on the slot matching its expiry. Expired timers go to the slot of the next tick processed and timers
+ * beyond the horizon to the last slot of the wheel, from where they are queued again.
+ * Must be called with the lock of base held.
+ */
+
+static void enqueue(timer_base_t *base, timer_t *timer) {
+        uint64_t expires = timer->expires;
+        if (expires < base->clk) {
+                expires = base->clk;
+        }
+        if (expires - base->clk > TIMER_MAX_TICKS) {
+                expires = base->clk + TIMER_MAX_TICKS;
+        }
+        uint64_t delta = expires - base->clk;
+        timer_t **head = &base->root[expires & TIMER_ROOT_MASK];
+        for (size_t level = 0; level < TIMER_LEVELS && delta >= (1ULL << (TIMER_ROOT_BITS + (level * TIMER_LEVEL_BITS))); level++) {
+                head = &base->levels[level][(expires >> (TIMER_ROOT_BITS + (level * TIMER_LEVEL_BITS))) & TIMER_LEVEL_MASK];
+        }
+        timer_list_add(head, timer);
+        timer->base = base;
+        base->pending++;
+}
+
+/*
+ * Queues the timers of a slot of from again on to: on the same wheel this cascades them one level down (or further
+ * when they expire soon enough). Must be called with the locks of both wheels held.
+ */
+
+static void requeue(timer_base_t *from, timer_base_t *to, timer_t **slot) {
+        timer_t *list = *slot;
+        *slot = NULL;
+        while (list) {
+                timer_t *timer = list;
+                list = timer->next;
+                from->pending--;
+                enqueue(to, timer);
+        }
+}
+
+/*
+ * Empties the wheel of the calling cpu, which starts at the current tick. Called when the tick of the cpu is set up,
+ * timers must not be added on a cpu before that.
+ */
+
+void timer_init_cpu() {
+        timer_base_t *base = this_cpu_ptr(timer_bases);
+        uint32_t eflags = lock_irqsave(&base->lock);
+        base->clk = get_jiffies();
+        base->pending = 0;
+        memset(base->root, 0x0, sizeof(base->root));
+        memset(base->levels, 0x0, sizeof(base->levels));
+        unlock_irqrestore(&base->lock, eflags);
+}
+
+/*
+ * Arms timer to call function(arg) once, at least ns nanoseconds from now. Returns -1 if timer is already pending or
+ * function is NULL.
+ */
+
+int timer_add(timer_t *timer, uint64_t ns, timer_func_t function, void *arg) {
+        if (function == NULL || timer_pending(timer)) {
+                return -1;
+        }
+        timer->function = function;
+        timer->arg = arg;
+
+        // The current tick is already partly elapsed, wait for one more.
+
+        timer->expires = get_jiffies() + ((ns + TICK_NSEC - 1) / TICK_NSEC) + 1;
+        timer_base_t *base = this_cpu_ptr(timer_bases);
+        uint32_t eflags = lock_irqsave(&base->lock);
+        enqueue(base, timer);
+        unlock_irqrestore(&base->lock, eflags);
+        return 0;
+}
+
+/*
+ * Locks the wheel timer is queued on, which changes when it is handed over to another cpu. Returns NULL if timer is not
+ * pending.
+ */
+
+static timer_base_t* lock_timer_base(timer_t *timer, uint32_t *eflags) {
+        while (true) {
+                timer_base_t *base = *(timer_base_t* volatile*) &timer->base;
+                if (base == NULL) {
+                        return NULL;
+                }
+                *eflags = lock_irqsave(&base->lock);
+                if (timer->base == base) {
+                        return base;
+                }
+                unlock_irqrestore(&base->lock, *eflags);
+        }
+}
+
+/*
+ * Returns 0 if timer was pending and will not fire, -1 if it was not pending. The callback of timer might still be
+ * running on another cpu.
+ */
+
+int timer_cancel(timer_t *timer) {
+        uint32_t eflags;
+        timer_base_t *base = lock_timer_base(timer, &eflags);
+        if (base == NULL) {
+                return -1;
+        }
+        timer_list_del(timer);
+        timer->base = NULL;
+        base->pending--;
+        unlock_irqrestore(&base->lock, eflags);
+        return 0;
+}
+
+/*
+ * Runs the timers of the calling cpu expired at the given tick. The ticks skipped while the cpu was idle are walked one
+ * by one only while timers are pending.
+ */
+
+void timer_run(uint64_t jiffies) {
+        timer_base_t *base = this_cpu_ptr(timer_bases);
+        uint32_t eflags = lock_irqsave(&base->lock);
+        while (base->clk <= jiffies) {
+                if (base->pending == 0) {
+                        base->clk = jiffies + 1;
+                        break;
+                }
+                uint64_t clk = base->clk;
+
+                // The root level wrapped around: refill it from the level above, which cascades further when it wraps too.
+
+                if (!(clk & TIMER_ROOT_MASK)) {
+                        for (size_t level = 0; level < TIMER_LEVELS; level++) {
+                                size_t index = (clk >> (TIMER_ROOT_BITS + (level * TIMER_LEVEL_BITS))) & TIMER_LEVEL_MASK;
+                                requeue(base, base, &base->levels[level][index]);
+                                if (index != 0) {
+                                        break;
+                                }
+                        }
+                }
+
+                // The slot is moved to a local list so that callbacks can cancel the timers still on it.
+
+                timer_t *list = base->root[clk & TIMER_ROOT_MASK];
+                base->root[clk & TIMER_ROOT_MASK] = NULL;
+                if (list) {
+                        list->pprev = &list;
+                }
+                base->clk++;
+                while (list) {
+                        timer_t *timer = list;
+                        timer_list_del(timer);
+                        timer->base = NULL;
+                        base->pending--;
+                        if (timer->expires > clk) {
+                                enqueue(base, timer);
+                                continue;
+                        }
+                        timer_func_t function = timer->function;
+                        void *arg = timer->arg;
+                        unlock_irqrestore(&base->lock, eflags);
+                        function(arg);
+                        eflags = lock_irqsave(&base->lock);
+                }
+        }
+        unlock_irqrestore(&base->lock, eflags);
+}
+
+/*
+ * Called from the tick interrupt of the calling cpu: raises the timer softirq if timers are due at the given tick, moves
+ * the wheel forward otherwise so that new timers are queued from the current tick.
+ */
+
+void timer_tick(uint64_t jiffies) {
+        timer_base_t *base = this_cpu_ptr(timer_bases);
+        uint32_t eflags = lock_irqsave(&base->lock);
+        if (base->clk <= jiffies) {
+                if (base->pending == 0) {
+                        base->clk = jiffies + 1;
+                }
+                else {
+                        raise_softirq_irqoff(SOFTIRQ_TIMER);
+                }
+        }
+        unlock_irqrestore(&base->lock, eflags);
+}
+
+void timer_softirq() {
+        timer_run(get_jiffies());
+}
+
+/*
+ * Returns the tick at which the calling cpu has to run its timers next or TIMER_NO_EXPIRY if none is pending. Only the
+ * root level is looked at: when it has nothing before it wraps around, the wrap (where the levels above cascade) is
+ * returned.
+ */
+
+uint64_t timer_next_expiry() {
+        timer_base_t *base = this_cpu_ptr(timer_bases);
+        uint32_t eflags = lock_irqsave(&base->lock);
+        uint64_t next = TIMER_NO_EXPIRY;
+        if (base->pending != 0) {
+                next = (base->clk | TIMER_ROOT_MASK) + 1;
+                if (!(base->clk & TIMER_ROOT_MASK)) {
+                        next = base->clk;
+                }
+                for (uint64_t clk = base->clk; clk < next; clk++) {
+                        if (base->root[clk & TIMER_ROOT_MASK]) {
+                                next = clk;
+                                break;
+                        }
+                }
+        }
+        unlock_irqrestore(&base->lock, eflags);
+        return next;
+}
+
+static void timer_migrate(timer_base_t *from, timer_base_t *to) {
+        timer_base_t *first = from < to ? from : to;
+        timer_base_t *second = from < to ? to : from;
+        uint32_t eflags = lock_irqsave(&first->lock);
+        lock(&second->lock);
+        for (size_t slot = 0; slot < TIMER_ROOT_SLOTS; slot++) {
+                requeue(from, to, &from->root[slot]);
+        }
+        for (size_t level = 0; level < TIMER_LEVELS; level++) {
+                for (size_t slot = 0; slot < TIMER_LEVEL_SLOTS; slot++) {
+                        requeue(from, to, &from->levels[level][slot]);
+                }
+        }
+        unlock(&second->lock);
+        unlock_irqrestore(&first->lock, eflags);
+}
+
+/*
+ * Called by a cpu about to stop its tick: its timers are handed over to a busy cpu, which ticks anyway, so that the idle
+ * cpu does not have to wake up for them. They stay if every other cpu is idle.
+ */
+
+void timer_migrate_idle() {
+        timer_base_t *base = this_cpu_ptr(timer_bases);
+        if (!smp || base->pending == 0) {
+                return;
+        }
+        size_t self = this_cpu_read(cpu_index);
+        for (size_t i = 1; i < num_cpus; i++) {
+                size_t target = (self + i) % num_cpus;
+                if (!cpumask_test(&cpu_online_mask, target) || sched_cpu_idle(target)) {
+                        continue;
+                }
+                timer_migrate(base, per_cpu_ptr(timer_bases, target));
+
+                // The target might have gone idle in the meantime, without seeing the timers: make it look again.
+
+                if (sched_cpu_idle(target)) {
+                        smp_send_reschedule(target);
+                }
+                return;
+        }
+}